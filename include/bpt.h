@@ -6,153 +6,1126 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
+#include <vector>
+#include "buffer_pool.h"
+#include "storage.h"
+#include "wal.h"
+#include "write_buffer.h"
+#include "key_search.h"
+#include "node_arena.h"
 
 namespace BPT
 {
+//未指定时新建B+树的阶数
 #define BP_ORDER 4
+//阶数下限，阶数过小时借和合并操作无法保证结点非空
+#define BP_MIN_ORDER 4
+//单个结点在磁盘上最多占用的大小，未指定PageSize时决定结点结构体的容量
+#define BP_MAX_NODE_SIZE 16384
+//结点头部（next、prev、n、order）的大小
+#define BP_NODE_HEADER_SIZE (2 * sizeof(off_t) + 2 * sizeof(size_t))
 
-//B+树元信息
+//B+树元信息，影子分页时两份交替写入
 #define OFFSET_META 0
+#define OFFSET_META_BACKUP (OFFSET_META + sizeof(meta_t))
 //用于存储B+树内容的位置
-#define OFFSET_BLOCK OFFSET_META + sizeof(meta_t)
+#define OFFSET_BLOCK (OFFSET_META + 2 * sizeof(meta_t))
+//顺序扫描时预读叶子结点个数的初始值和上限
+#define BP_READAHEAD_MIN 4
+#define BP_READAHEAD_MAX 64
+//页面版本号的槽数，页面按偏移量散列到各个槽
+#define BP_VERSION_SLOTS 4096
+//不加锁的查找连续失败该次数后改为加共享锁查找
+#define BP_OPTIMISTIC_RETRIES 8
+//写缓冲中同一个key的修改按key散列到的锁的个数
+#define BP_KEY_STRIPES 64
+//并行建树时每个线程至少处理的数据项个数，数据较少时使用较少的线程
+#define BP_PARALLEL_GRAIN 4096
+//并行范围扫描时每个线程平均至少分到的分隔key个数，不够时继续展开下一层内部结点
+#define BP_SCAN_SPLITS 4
+//并行排序时从每一段中抽取的样本个数，用于选出划分范围的分隔key
+#define BP_SORT_SAMPLES 64
+//保存和载入快照时每次复制的字节数
+#define BP_SNAPSHOT_CHUNK (BP_PAGE_SIZE * 256)
 //结点除过所存储数据占用的大小，用于仅修改结点结构的情况使用
-#define SIZE_NO_CHILDREN sizeof(leaf_node_t) - BP_ORDER * sizeof(record_t)
+#define SIZE_NO_CHILDREN BP_NODE_HEADER_SIZE
+//文件格式的版本号，结点或元数据的布局改变时加一。
+//3：结点中key与value（孩子结点）分开存放，不保存父结点
+//4：元数据中记录内部结点是否保存子树的汇总值
+//5：结点头部记录阶数，内存中的结点与磁盘上的布局相同
+#define BP_FORMAT_VERSION 5
 
-    //定义索引结构和数据结构
+    //定义默认的索引结构和数据结构
     typedef int value_t;
-    struct key_t
+    //定长的字符串key，占用N个字节，字符串最多N - 1个字符，不足的部分补0。
+    //默认的key_t占用16个字节，key较短时使用较小的N，每个结点可以容纳更多的key。
+    //更长的字符串不截断，只保留前N个字符且不以0结尾：这样的key大于所有能存入的key，
+    //查找时找不到，作为范围的上界时不限制范围，插入时被B+树拒绝
+    template <size_t N>
+    struct basic_key_t
     {
-        char k[16];
-        key_t(const char *str = "")
+        char k[N];
+        basic_key_t(const char *str = "")
         {
             bzero(k, sizeof(k));
-            strcpy(k, str);
+            memcpy(k, str, strnlen(str, N));
         }
-        operator bool() const
+        //字符串超过N - 1个字符，不能存入B+树
+        bool too_long() const
         {
-            return strcmp(k, "");
+            return k[N - 1] != 0;
         }
     };
+    typedef basic_key_t<16> key_t;
+    //只有定长的字符串key可能超长
+    template <class Key>
+    inline bool key_too_long(const Key &)
+    {
+        return false;
+    }
+    template <size_t N>
+    inline bool key_too_long(const basic_key_t<N> &key)
+    {
+        return key.too_long();
+    }
+
+    //key的规范化编码：长度，以及前面的字符在高位、按大端序排成的整数（长度之后的字节不计入）。
+    //先比较长度再比较整数，结果与keycmp相同。只用于N不超过8的key
+    struct key_code_t
+    {
+        uint64_t len;
+        uint64_t word;
+    };
+    template <size_t N>
+    inline key_code_t key_code(const basic_key_t<N> &key)
+    {
+        static_assert(N <= 8, "key too long for a 64-bit code");
+        uint64_t w = 0;
+        memcpy(&w, key.k, N);
+        //第一个0字节的位置即长度，没有0字节时长度为N
+        uint64_t zero = (w - 0x0101010101010101ULL) & ~w & 0x8080808080808080ULL;
+        key_code_t code;
+        code.len = zero != 0 ? __builtin_ctzll(zero) / 8 : N;
+        if (code.len < 8)
+            w &= ((uint64_t)1 << (code.len * 8)) - 1;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        w = __builtin_bswap64(w);
+#endif
+        code.word = w;
+        return code;
+    }
 
     //重载操作符，最终目的是使用stl里的算法去处理自定义的数据结构。
     //必须声明成inline，否则链接时会出现duplicate symbol
+    //先比较长度，长度相同时按字节比较
+    template <size_t N>
+    inline int keycmp(const basic_key_t<N> &a, const basic_key_t<N> &b)
+    {
+        if constexpr (N <= 8)
+        {
+            key_code_t x = key_code(a), y = key_code(b);
+            if (x.len != y.len)
+                return x.len < y.len ? -1 : 1;
+            return x.word < y.word ? -1 : x.word > y.word;
+        }
+        else
+        {
+            size_t la = strnlen(a.k, N), lb = strnlen(b.k, N);
+            if (la != lb)
+                return la < lb ? -1 : 1;
+            return memcmp(a.k, b.k, la);
+        }
+    }
+    //SSE2下一次比较16个字节，由掩码得到长度和第一个不同的字节
+    template <>
     inline int keycmp(const key_t &a, const key_t &b)
     {
-        int x = strlen(a.k) - strlen(b.k);
-        return x == 0 ? strcmp(a.k, b.k) : x;
+#ifdef __SSE2__
+        __m128i x = _mm_loadu_si128((const __m128i *)a.k);
+        __m128i y = _mm_loadu_si128((const __m128i *)b.k);
+        __m128i zero = _mm_setzero_si128();
+        //最高位之后补1，没有0字节时长度为16
+        int la = __builtin_ctz(_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) | 0x10000);
+        int lb = __builtin_ctz(_mm_movemask_epi8(_mm_cmpeq_epi8(y, zero)) | 0x10000);
+        if (la != lb)
+            return la - lb;
+        //只比较长度以内的字节，0字节之后的内容不影响结果
+        int diff = (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff) & ((1 << la) - 1);
+        if (diff == 0)
+            return 0;
+        int i = __builtin_ctz(diff);
+        return (unsigned char)a.k[i] - (unsigned char)b.k[i];
+#else
+        int x = strnlen(a.k, sizeof(a.k)) - strnlen(b.k, sizeof(b.k));
+        return x == 0 ? memcmp(a.k, b.k, strnlen(a.k, sizeof(a.k))) : x;
+#endif
     }
     //用于单元测试
-        inline int keycmp_ut(const key_t &l, const key_t &r)
+    inline int keycmp_ut(const key_t &l, const key_t &r)
     {
         return strcmp(l.k, r.k);
     }
+
+    //三路比较函数，a < b 返回负数，a == b 返回0，a > b 返回正数
+    template <class Key>
+    struct key_compare
+    {
+        int operator()(const Key &a, const Key &b) const
+        {
+            return a < b ? -1 : (b < a ? 1 : 0);
+        }
+    };
+    template <size_t N>
+    struct key_compare<basic_key_t<N> >
+    {
+        int operator()(const basic_key_t<N> &a, const basic_key_t<N> &b) const
+        {
+            return keycmp(a, b);
+        }
+    };
+    //整数key使用默认顺序时，结点内查找用SIMD比较
+    template <class Int>
+    struct key_search<Int, key_compare<Int>,
+                      typename std::enable_if<std::is_integral<Int>::value &&
+                                              !std::is_same<Int, bool>::value>::type>
+        : int_search<Int>
+    {
+    };
+    //不超过8个字节的字符串key，先算出要查找的key的规范化编码，
+    //查找时每个key只需一次64位读入和整数比较
+    template <size_t N>
+    struct key_search<basic_key_t<N>, key_compare<basic_key_t<N> >, typename std::enable_if<(N <= 8)>::type>
+    {
+        typedef basic_key_t<N> key_type;
+        static size_t lower_bound(const key_type *keys, size_t n, const key_type &key)
+        {
+            return search<false>(keys, n, key_code(key));
+        }
+        static size_t upper_bound(const key_type *keys, size_t n, const key_type &key)
+        {
+            return search<true>(keys, n, key_code(key));
+        }
+
+    private:
+        template <bool upper>
+        static bool before(const key_type &k, const key_code_t &code)
+        {
+            key_code_t c = key_code(k);
+            return c.len < code.len || (c.len == code.len && (upper ? c.word <= code.word : c.word < code.word));
+        }
+        template <bool upper>
+        static size_t search(const key_type *keys, size_t n, const key_code_t &code)
+        {
+            if (n == 0)
+                return 0;
+            const key_type *base = keys;
+            while (n > 1)
+            {
+                size_t half = n / 2;
+                prefetch(base, n, half);
+                base = before<upper>(base[half], code) ? base + half : base;
+                n -= half;
+            }
+            return base - keys + before<upper>(*base, code);
+        }
+    };
     //一棵b+树所需要的元数据
     typedef struct
     {
+        uint64_t format; //文件格式的版本号，与BP_FORMAT_VERSION不同的文件不能打开
         size_t order; //B+树的阶数
         size_t value_size;
         size_t key_size;
+        size_t aggregate_size;    //内部结点中每个孩子结点的汇总值大小，为0表示不保存汇总值
         size_t internal_node_num; //内部结点个数
         size_t leaf_node_num;     //叶子结点个数
         size_t height;            //B+树高度（不包括叶子结点）
         off_t slot;               //储存新数据块的位置
         off_t root_offset;        //根结点位置
         off_t leaf_offset;        //第一个叶子结点位置
+        off_t free_leaf;          //空闲叶子结点链表
+        off_t free_internal;      //空闲内部结点链表
+        //以下用于影子分页，其他情况下均为0
+        uint64_t generation;        //提交次数，两份元数据中较新的一份有效
+        off_t shadow;               //最后一次提交的影子页位置
+        size_t shadow_pages;        //最后一次提交的影子页个数
+        off_t shadow_area[2];       //两块交替使用的影子区
+        size_t shadow_capacity[2];  //影子区能容纳的页面个数
+        uint64_t checksum;          //除本字段之外所有内容的校验和
     } meta_t;
 
-    //索引项结构
-    struct index_t
+    //子树的汇总值：数据项个数，value为算术类型时还有和、最小值和最大值，count为0时其余成员没有意义。
+    //没有构造函数，结点中的汇总值数组不必逐项初始化，空的汇总值使用值初始化的aggregate_t()
+    template <class Value, class Enable = void>
+    struct basic_aggregate_t
+    {
+        uint64_t count;
+
+        void add(const Value &)
+        {
+            ++count;
+        }
+        void merge(const basic_aggregate_t &other)
+        {
+            count += other.count;
+        }
+        //去掉一个value，结果不能由汇总值本身得出时返回false
+        bool subtract(const Value &)
+        {
+            --count;
+            return true;
+        }
+        bool operator==(const basic_aggregate_t &other) const
+        {
+            return count == other.count;
+        }
+    };
+    template <class Value>
+    struct basic_aggregate_t<Value, typename std::enable_if<std::is_arithmetic<Value>::value>::type>
     {
-        key_t key;
-        off_t child; //孩子结点的偏移量
+        //整数按64位累加，浮点数按double累加
+        typedef typename std::conditional<
+            std::is_floating_point<Value>::value, double,
+            typename std::conditional<std::is_signed<Value>::value, int64_t, uint64_t>::type>::type sum_t;
+        uint64_t count;
+        sum_t sum;
+        Value min;
+        Value max;
+
+        void add(const Value &value)
+        {
+            if (count++ == 0)
+            {
+                sum = value;
+                min = max = value;
+                return;
+            }
+            sum += value;
+            if (value < min)
+                min = value;
+            if (max < value)
+                max = value;
+        }
+        void merge(const basic_aggregate_t &other)
+        {
+            if (other.count == 0)
+                return;
+            if (count == 0)
+            {
+                *this = other;
+                return;
+            }
+            count += other.count;
+            sum += other.sum;
+            if (other.min < min)
+                min = other.min;
+            if (max < other.max)
+                max = other.max;
+        }
+        //去掉的是最小值或最大值时，新的最小值、最大值只能由孩子结点重新算出
+        bool subtract(const Value &value)
+        {
+            --count;
+            sum -= value;
+            return count == 0 || (min < value && value < max);
+        }
+        bool operator==(const basic_aggregate_t &other) const
+        {
+            return count == other.count &&
+                   (count == 0 || (sum == other.sum && min == other.min && max == other.max));
+        }
     };
-    //内部节点结构
-    struct internal_node_t
+
+    //索引项结构
+    template <class Key, class Aggregate>
+    struct basic_index_t
     {
-        typedef index_t *child_t;
-        off_t parent; //父亲结点的偏移量
-        off_t next;
-        off_t prev;
-        size_t n; //孩子个数
-        index_t children[BP_ORDER];
+        Key key;
+        off_t child;   //孩子结点的偏移量
+        Aggregate agg; //孩子结点的汇总值
     };
     //数据项结构
-    struct record_t
+    template <class Key, class Value>
+    struct basic_record_t
+    {
+        Key key;
+        Value value;
+    };
+    //结点中的key和value（孩子结点）分别连续存放，查找时只访问key数组。
+    //以下引用把各个数组中同一下标的元素当作一个索引项或数据项访问，
+    //Key和Value为const类型时是只读的引用
+    template <class Key, class Aggregate>
+    struct basic_index_ref
+    {
+        typedef basic_index_t<typename std::remove_const<Key>::type,
+                              typename std::remove_const<Aggregate>::type>
+            entry_t;
+        Key &key;
+        typename std::conditional<std::is_const<Key>::value, const off_t, off_t>::type &child;
+        Aggregate &agg;
+
+        template <class C>
+        basic_index_ref(Key &key, C &child, Aggregate &agg) : key(key), child(child), agg(agg) {}
+        template <class K, class A>
+        basic_index_ref(const basic_index_ref<K, A> &other) : key(other.key), child(other.child), agg(other.agg) {}
+        basic_index_ref(const basic_index_ref &other) : key(other.key), child(other.child), agg(other.agg) {}
+        operator entry_t() const
+        {
+            entry_t entry;
+            entry.key = key;
+            entry.child = child;
+            entry.agg = agg;
+            return entry;
+        }
+        //赋值时复制所引用的内容
+        const basic_index_ref &operator=(const entry_t &entry) const
+        {
+            key = entry.key;
+            child = entry.child;
+            agg = entry.agg;
+            return *this;
+        }
+        const basic_index_ref &operator=(const basic_index_ref &other) const
+        {
+            return *this = (entry_t)other;
+        }
+        template <class K, class A>
+        const basic_index_ref &operator=(const basic_index_ref<K, A> &other) const
+        {
+            return *this = (entry_t)other;
+        }
+    };
+    template <class Key, class Value>
+    struct basic_record_ref
+    {
+        typedef basic_record_t<typename std::remove_const<Key>::type,
+                               typename std::remove_const<Value>::type>
+            entry_t;
+        Key &key;
+        Value &value;
+
+        basic_record_ref(Key &key, Value &value) : key(key), value(value) {}
+        template <class K, class V>
+        basic_record_ref(const basic_record_ref<K, V> &other) : key(other.key), value(other.value) {}
+        basic_record_ref(const basic_record_ref &other) : key(other.key), value(other.value) {}
+        operator entry_t() const
+        {
+            entry_t entry;
+            entry.key = key;
+            entry.value = value;
+            return entry;
+        }
+        const basic_record_ref &operator=(const entry_t &entry) const
+        {
+            key = entry.key;
+            value = entry.value;
+            return *this;
+        }
+        const basic_record_ref &operator=(const basic_record_ref &other) const
+        {
+            return *this = (entry_t)other;
+        }
+        template <class K, class V>
+        const basic_record_ref &operator=(const basic_record_ref<K, V> &other) const
+        {
+            return *this = (entry_t)other;
+        }
+    };
+    //迭代器指向的各个数组：key数组、value（孩子结点）数组，内部结点还有汇总值数组（Extra）
+    template <class Key, class Value, class Extra>
+    struct node_arrays
+    {
+        Key *keys;
+        Value *values;
+        Extra *extras;
+
+        node_arrays(Key *keys = NULL, Value *values = NULL, Extra *extras = NULL) : keys(keys), values(values), extras(extras) {}
+        template <class K, class V, class E>
+        node_arrays(const node_arrays<K, V, E> &other) : keys(other.keys), values(other.values), extras(other.extras) {}
+        void advance(ptrdiff_t i)
+        {
+            keys += i, values += i, extras += i;
+        }
+        template <class Ref>
+        Ref at(ptrdiff_t i) const
+        {
+            return Ref(keys[i], values[i], extras[i]);
+        }
+    };
+    template <class Key, class Value>
+    struct node_arrays<Key, Value, void>
+    {
+        Key *keys;
+        Value *values;
+
+        node_arrays(Key *keys = NULL, Value *values = NULL) : keys(keys), values(values) {}
+        template <class K, class V>
+        node_arrays(const node_arrays<K, V, void> &other) : keys(other.keys), values(other.values) {}
+        void advance(ptrdiff_t i)
+        {
+            keys += i, values += i;
+        }
+        template <class Ref>
+        Ref at(ptrdiff_t i) const
+        {
+            return Ref(keys[i], values[i]);
+        }
+    };
+    //结点中数据项的随机访问迭代器，同时指向各个数组中的同一下标，
+    //解引用得到Ref。可以用于STL的复制、查找等算法
+    template <class Ref, class Key, class Value, class Extra = void>
+    class node_iterator
+    {
+    public:
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef typename Ref::entry_t value_type;
+        typedef ptrdiff_t difference_type;
+        typedef Ref reference;
+        typedef node_arrays<Key, Value, Extra> arrays_t;
+        struct pointer
+        {
+            Ref ref;
+            const Ref *operator->() const
+            {
+                return &ref;
+            }
+        };
+
+        node_iterator() {}
+        explicit node_iterator(const arrays_t &arrays) : p(arrays) {}
+        //可写的迭代器可以转换为只读的迭代器
+        template <class R, class K, class V, class E>
+        node_iterator(const node_iterator<R, K, V, E> &other) : p(other.arrays()) {}
+
+        const arrays_t &arrays() const
+        {
+            return p;
+        }
+        Key *key_ptr() const
+        {
+            return p.keys;
+        }
+        Ref operator*() const
+        {
+            return p.template at<Ref>(0);
+        }
+        pointer operator->() const
+        {
+            pointer ptr = {**this};
+            return ptr;
+        }
+        Ref operator[](difference_type i) const
+        {
+            return p.template at<Ref>(i);
+        }
+        node_iterator &operator++()
+        {
+            p.advance(1);
+            return *this;
+        }
+        node_iterator &operator--()
+        {
+            p.advance(-1);
+            return *this;
+        }
+        node_iterator operator++(int)
+        {
+            node_iterator it = *this;
+            ++*this;
+            return it;
+        }
+        node_iterator operator--(int)
+        {
+            node_iterator it = *this;
+            --*this;
+            return it;
+        }
+        node_iterator &operator+=(difference_type i)
+        {
+            p.advance(i);
+            return *this;
+        }
+        node_iterator &operator-=(difference_type i)
+        {
+            p.advance(-i);
+            return *this;
+        }
+        node_iterator operator+(difference_type i) const
+        {
+            node_iterator it = *this;
+            return it += i;
+        }
+        friend node_iterator operator+(difference_type i, const node_iterator &it)
+        {
+            return it + i;
+        }
+        node_iterator operator-(difference_type i) const
+        {
+            node_iterator it = *this;
+            return it -= i;
+        }
+        difference_type operator-(const node_iterator &other) const
+        {
+            return p.keys - other.p.keys;
+        }
+        bool operator==(const node_iterator &other) const
+        {
+            return p.keys == other.p.keys;
+        }
+        bool operator!=(const node_iterator &other) const
+        {
+            return p.keys != other.p.keys;
+        }
+        bool operator<(const node_iterator &other) const
+        {
+            return p.keys < other.p.keys;
+        }
+        bool operator>(const node_iterator &other) const
+        {
+            return p.keys > other.p.keys;
+        }
+        bool operator<=(const node_iterator &other) const
+        {
+            return p.keys <= other.p.keys;
+        }
+        bool operator>=(const node_iterator &other) const
+        {
+            return p.keys >= other.p.keys;
+        }
+
+    private:
+        arrays_t p;
+    };
+
+    //将size向上对齐到align的整数倍
+    inline size_t align_up(size_t size, size_t align)
     {
-        key_t key;
-        value_t value;
+        return (size + align - 1) / align * align;
+    }
+
+    //内部节点结构，容量为PageSize字节所能容纳的索引项个数。
+    //结点在内存中与磁盘上的布局相同：头部、order个key，其后依次是order个孩子结点和
+    //（保存汇总值时）order个孩子结点的汇总值，各数组按元素类型对齐。
+    //结构体按容量预留空间，阶数较小时其后的部分不使用，映射中的结点可以直接访问
+    template <class Key, class Aggregate, size_t PageSize>
+    struct basic_internal_node_t
+    {
+        typedef basic_index_t<Key, Aggregate> index_t;
+        typedef node_iterator<basic_index_ref<Key, Aggregate>, Key, off_t, Aggregate> child_t;
+        typedef node_iterator<basic_index_ref<const Key, const Aggregate>, const Key, const off_t, const Aggregate>
+            const_child_t;
+        static const size_t capacity = (PageSize - BP_NODE_HEADER_SIZE) / (sizeof(Key) + sizeof(off_t));
+        off_t next;
+        off_t prev;
+        size_t n;     //孩子个数
+        size_t order; //结点的阶数，决定孩子结点数组和汇总值数组的位置
+        Key keys[capacity];
+        off_t space[capacity];     //孩子结点数组的空间，数组从children_at(order)处开始
+        Aggregate extra[capacity]; //汇总值数组的空间，不保存汇总值时不写入磁盘
+
+        //order阶的结点中孩子结点数组、汇总值数组相对于结点开头的位置
+        static size_t children_at(size_t order)
+        {
+            return align_up(BP_NODE_HEADER_SIZE + order * sizeof(Key), alignof(off_t));
+        }
+        static size_t aggs_at(size_t order)
+        {
+            return align_up(children_at(order) + order * sizeof(off_t), alignof(Aggregate));
+        }
+        //order阶的结点在磁盘上的大小
+        static size_t size_at(size_t order, bool aggregated)
+        {
+            return aggregated ? aggs_at(order) + order * sizeof(Aggregate)
+                              : children_at(order) + order * sizeof(off_t);
+        }
+        off_t *children()
+        {
+            return (off_t *)((char *)this + children_at(order));
+        }
+        const off_t *children() const
+        {
+            return (const off_t *)((const char *)this + children_at(order));
+        }
+        Aggregate *aggs()
+        {
+            return (Aggregate *)((char *)this + aggs_at(order));
+        }
+        const Aggregate *aggs() const
+        {
+            return (const Aggregate *)((const char *)this + aggs_at(order));
+        }
+
+        child_t begin()
+        {
+            return child_t(typename child_t::arrays_t(keys, children(), aggs()));
+        }
+        const_child_t begin() const
+        {
+            return const_child_t(typename const_child_t::arrays_t(keys, children(), aggs()));
+        }
     };
-    //叶子节点结构
-    struct leaf_node_t
+    //叶子节点结构，容量为PageSize字节所能容纳的数据项个数。
+    //结点在内存中与磁盘上的布局相同：头部、order个key，其后是按Value对齐的order个value
+    template <class Key, class Value, size_t PageSize>
+    struct basic_leaf_node_t
     {
-        typedef record_t *child_t;
-        off_t parent; //父结点偏移量
+        typedef basic_record_t<Key, Value> record_t;
+        typedef node_iterator<basic_record_ref<Key, Value>, Key, Value> child_t;
+        typedef node_iterator<basic_record_ref<const Key, const Value>, const Key, const Value> const_child_t;
+        static const size_t capacity = (PageSize - BP_NODE_HEADER_SIZE) / (sizeof(Key) + sizeof(Value));
         off_t next;
         off_t prev;
         size_t n;
-        record_t children[BP_ORDER];
+        size_t order; //结点的阶数，决定value数组的位置
+        Key keys[capacity];
+        Value space[capacity]; //value数组的空间，数组从values_at(order)处开始
+
+        //order阶的结点中value数组相对于结点开头的位置，以及结点在磁盘上的大小
+        static size_t values_at(size_t order)
+        {
+            return align_up(BP_NODE_HEADER_SIZE + order * sizeof(Key), alignof(Value));
+        }
+        static size_t size_at(size_t order)
+        {
+            return values_at(order) + order * sizeof(Value);
+        }
+        Value *values()
+        {
+            return (Value *)((char *)this + values_at(order));
+        }
+        const Value *values() const
+        {
+            return (const Value *)((const char *)this + values_at(order));
+        }
+
+        child_t begin()
+        {
+            return child_t(typename child_t::arrays_t(keys, values()));
+        }
+        const_child_t begin() const
+        {
+            return const_child_t(typename const_child_t::arrays_t(keys, values()));
+        }
+    };
+
+    //沿叶子结点链表扫描时的预读状态
+    struct readahead_t
+    {
+        off_t expect; //叶子结点在文件中连续存放时，下一个要访问的结点的位置
+        off_t edge;   //已经提示预读到的位置，为0表示没有
+        size_t depth; //预读的叶子结点个数，连续访问时加倍
+        readahead_t() : expect(0), edge(0), depth(0) {}
+    };
+
+    //修改操作在结点帧与存储之间复制的字节数，映射模式下直接访问的结点不计入
+    struct copy_stats_t
+    {
+        uint64_t operations;    //修改操作的次数
+        uint64_t bytes_read;    //读入结点帧的字节数
+        uint64_t bytes_written; //写回存储（开启日志时为pending）的字节数
+    };
+
+    //是否为随机访问迭代器，没有声明迭代器类型的输入迭代器视为不是
+    template <class It, class = void>
+    struct is_random_access : std::false_type
+    {
+    };
+    template <class It>
+    struct is_random_access<It, std::void_t<typename std::iterator_traits<It>::iterator_category> >
+        : std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<It>::iterator_category>
+    {
+    };
+
+    //存储方式
+    enum storage_mode_t
+    {
+        STORAGE_CACHE,  //经由页缓存读写文件
+        STORAGE_MMAP,   //将整个文件映射到内存，查找时直接访问文件中的结点
+        STORAGE_MEMORY  //结点只存放在匿名内存中，不使用文件和日志，可以用snapshot()保存到文件。
+                        //与映射模式一样，只读访问的结点不论阶数都不复制
+    };
+
+    //B+树的运行参数
+    struct options_t
+    {
+        storage_mode_t mode;
+        size_t cache_pages; //页缓存的页面个数
+        bool direct_io;     //使用O_DIRECT读写，绕过系统的页缓存
+        wal_mode_t wal;     //写前日志的落盘方式，日志文件为数据库文件名加上.wal。
+                            //映射模式下页面可能随时被写回，WAL_ASYNC每次提交同样等待日志落盘
+        //影子分页：修改过的页面先写入影子区，落盘后写入另一份元数据即完成提交，
+        //打开时最多写回一批影子页。与写前日志互斥，开启时忽略wal。
+        //提交之后页面仍写回原位置，不保留旧版本，查找只能看到最新提交的内容
+        bool shadow_paging;
+        //新建B+树的阶数，page_size不为0时由结点大小推算，
+        //两者只在新建时起作用，打开已有文件时使用文件中记录的阶数
+        size_t order;
+        size_t page_size;
+        //内部结点的每个索引项保存孩子结点子树的汇总值（个数、和、最小值、最大值），
+        //范围汇总和按序号查找只需访问O(高度)个结点。与阶数一样只在新建时起作用
+        bool aggregate;
+        //写缓冲：修改先写入内存中的跳表，数据项达到buffer_size时由后台线程合并入B+树，
+        //为0时不使用。缓冲中的修改在合并之前不写日志，checkpoint和析构时会先合并
+        size_t buffer_size;
+        options_t() : mode(STORAGE_CACHE), cache_pages(BP_CACHE_PAGES), direct_io(false),
+                      wal(WAL_OFF), shadow_paging(false), order(BP_ORDER), page_size(0),
+                      aggregate(false), buffer_size(0) {}
     };
 
     //b+树
-    class bpt
+    //Key和Value需要能够按字节复制，Compare是Key的三路比较函数，
+    //PageSize决定结点结构体的容量，即运行时所能选择的最大阶数
+    template <class Key, class Value, class Compare = key_compare<Key>,
+              size_t PageSize = BP_MAX_NODE_SIZE>
+    class basic_bpt
     {
     public:
-        bpt(const char *path, bool force_empty = false);
+        typedef Key key_t;
+        typedef Value value_t;
+        typedef basic_aggregate_t<Value> aggregate_t;
+        typedef basic_index_t<Key, aggregate_t> index_t;
+        typedef basic_record_t<Key, Value> record_t;
+        typedef basic_internal_node_t<Key, aggregate_t, PageSize> internal_node_t;
+        typedef basic_leaf_node_t<Key, Value, PageSize> leaf_node_t;
+        //结点中索引项、数据项的迭代器
+        typedef typename internal_node_t::child_t index_iterator;
+        typedef typename internal_node_t::const_child_t const_index_iterator;
+        typedef typename leaf_node_t::child_t record_iterator;
+        typedef typename leaf_node_t::const_child_t const_record_iterator;
+
+        //B+树允许的最大阶数
+        static const size_t max_order =
+            leaf_node_t::capacity < internal_node_t::capacity ? leaf_node_t::capacity
+                                                              : internal_node_t::capacity;
+        static_assert(max_order >= BP_MIN_ORDER, "PageSize too small");
+        static_assert(offsetof(internal_node_t, keys) == BP_NODE_HEADER_SIZE &&
+                          offsetof(leaf_node_t, keys) == BP_NODE_HEADER_SIZE,
+                      "node header layout");
+
+        //page_size字节的结点能容纳的最大阶数，aggregated为真时内部结点还要存放汇总值
+        static size_t order_of_page(size_t page_size, bool aggregated = false)
+        {
+            size_t branch = sizeof(off_t) + (aggregated ? sizeof(aggregate_t) : 0);
+            size_t max_children = sizeof(Value) > branch ? sizeof(Value) : branch;
+            size_t order = (page_size - BP_NODE_HEADER_SIZE) / (sizeof(Key) + max_children);
+            //数组之间按元素类型对齐，补齐的部分可能使结点超出page_size
+            while (order > 0 && (leaf_node_t::size_at(order) > page_size ||
+                                 internal_node_t::size_at(order, aggregated) > page_size))
+                order--;
+            return order;
+        }
+
+        //options.mode为STORAGE_MEMORY时path为快照文件，不为空且force_empty为假时载入其中的内容
+        basic_bpt(const char *path, bool force_empty = false,
+                  const options_t &options = options_t());
+        //只在内存中的空B+树，忽略options中的存储方式、日志和影子分页
+        explicit basic_bpt(const options_t &options);
+        ~basic_bpt();
         int search(const key_t &key, value_t *value) const;
         int search_range(key_t *left, const key_t &right,
                          value_t *values, size_t max, bool *next = NULL) const;
+        //用threads个线程扫描[left, right]：按上层内部结点的分隔key把范围分成互不相交的几段，
+        //每个线程沿叶子结点链表扫描一段，对其中每个数据项调用callback(段号, key, value)。
+        //同一段的数据项按key的顺序在同一个线程中回调，不同段的回调可能同时发生，段号越小key越小。
+        //有写缓冲时先合并。threads为0时使用硬件线程数，返回数据项的个数，left大于right时返回0
+        template <class F>
+        size_t search_range_parallel(const key_t &left, const key_t &right, F callback, size_t threads = 0);
+        //批量查找n个key，结果按keys的顺序写入values，status[i]为0表示找到。
+        //相邻的key共用从根结点出发的路径，落在同一个叶子结点的key只读一次该结点。返回找到的个数
+        int search_batch(const key_t *keys, size_t n, value_t *values, int *status) const;
+        //[left, right]内数据项的汇总值。保存了汇总值时只访问两条从根结点到叶子结点的路径，
+        //否则沿叶子结点链表扫描。有写缓冲时先合并，left大于right时返回空的汇总值
+        aggregate_t aggregate(const key_t &left, const key_t &right);
+        //小于key的数据项个数
+        size_t rank(const key_t &key);
+        //按key升序的第k个（从0开始）数据项，k不小于数据项个数时返回-1
+        int select(size_t k, key_t *key, value_t *value);
+        //key超长（见basic_key_t）时插入、更新和删除都返回-1
         int remove(const key_t &key);
         int insert(const key_t &key, value_t value);
         int update(const key_t &key, value_t value);
+        //将写缓冲中的修改合并入B+树，返回合并的key的个数
+        int drain();
         meta_t get_meta()
         {
+            std::shared_lock<std::shared_mutex> lock(latch);
             return meta;
         }
+        //将所有修改写入数据库文件并落盘，然后清空日志
+        int checkpoint()
+        {
+            drain();
+            std::unique_lock<std::shared_mutex> lock(latch);
+            return make_checkpoint();
+        }
+        int make_checkpoint();
+        copy_stats_t copy_stats() const
+        {
+            copy_stats_t stats;
+            stats.operations = copy_ops.load(std::memory_order_relaxed);
+            stats.bytes_read = copied_in.load(std::memory_order_relaxed);
+            stats.bytes_written = copied_out.load(std::memory_order_relaxed);
+            return stats;
+        }
+        void reset_copy_stats()
+        {
+            copy_ops.store(0, std::memory_order_relaxed);
+            copied_in.store(0, std::memory_order_relaxed);
+            copied_out.store(0, std::memory_order_relaxed);
+        }
+        //将B+树的当前内容写入path处的文件并落盘，之后可以按任意存储方式打开。
+        //先合并写缓冲，复制期间阻塞修改操作
+        int snapshot(const char *path);
+
+        //沿叶子结点链表顺序或逆序遍历数据项，不必每次从根结点重新查找。
+        //游标持有当前叶子结点的副本，修改B+树之后游标失效；
+        //与修改操作并发时，只保证每次读入的单个叶子结点是一致的，读到的key仍然严格有序，
+        //两次读入之间被修改的数据项可能被跳过。
+        //游标只遍历B+树本身，看不到写缓冲中尚未合并的修改，需要时先调用drain()
+        class cursor
+        {
+        public:
+            explicit cursor(const basic_bpt &tree) : tree(&tree), offset(0), slot(0)
+            {
+                leaf.n = 0;
+            }
+            //定位到第一个大于等于key的数据项
+            bool seek(const key_t &key);
+            //定位到最后一个小于等于key的数据项，用于逆序遍历
+            bool seek_for_prev(const key_t &key);
+            bool seek_first();
+            bool seek_last();
+            //移动到下一个/上一个数据项，越过两端时返回false并使游标无效
+            bool next();
+            bool prev();
+            bool valid() const
+            {
+                return offset != 0;
+            }
+            const key_t &key() const
+            {
+                return leaf.keys[slot];
+            }
+            const value_t &value() const
+            {
+                return leaf.values()[slot];
+            }
+
+        private:
+            //读入offset处的叶子结点，跳过空的叶子结点
+            bool load(off_t offset, bool forward);
+            //沿兄弟指针读到的结点不在key之后（forward为假时之前）：两次读入之间原来的兄弟
+            //结点被合并回收并另作他用，从根结点重新定位到key之后（之前）的数据项
+            bool relocate(const key_t &key, bool forward);
+
+            const basic_bpt *tree;
+            off_t offset; //当前叶子结点，为0时游标无效
+            size_t slot;  //当前数据项在叶子结点中的下标
+            leaf_node_t leaf;
+            readahead_t ra;
+        };
 
         char path[512];
         meta_t meta;
 
-        //初始化一颗空的B+树
-        void init_from_empty();
+        //初始化一颗空的B+树，aggregated为真时内部结点保存汇总值
+        void init_from_empty(size_t order = BP_ORDER, bool aggregated = false);
+        //清空元数据，只保留结点格式，结点从OFFSET_BLOCK开始分配
+        void reset_meta(size_t order, bool aggregated);
+        //清空数据库文件，缓存和映射中的旧页面随之失效
+        void truncate_file();
+
+        /*
+            *******
+            批量操作
+            *******
+        */
+        //由按key严格递增的数据项（record_t或std::pair）自底向上建树，原有数据被清空。
+        //fill_factor为每个结点的填充率；输入不是严格递增或有超长的key时返回-1，并留下一棵空树。
+        template <class It>
+        int bulk_load(It first, It last, double fill_factor = 1.0);
+        //并行建树：输入（record_t或std::pair）可以无序，key重复时保留最先出现的一个，原有数据被清空。
+        //先并行排序去重，叶子结点在文件中连续分配，兄弟指针由位置直接算出，
+        //各线程写入各自的一段叶子结点，内部结点同样逐层并行写入。
+        //threads为0时使用硬件线程数，数据较少时使用较少的线程。有超长的key时返回-1，不修改B+树
+        template <class It>
+        int bulk_load_parallel(It first, It last, size_t threads = 0, double fill_factor = 1.0);
+        //threads个线程排序records并去掉重复的key，相同的key保留在records中最靠前的一个。
+        //各线程先排好自己的一段，再按抽样选出的分隔key划分范围，每个线程归并一个范围
+        static void parallel_sort(std::vector<record_t> &records, size_t threads);
+        //把[0, n)平均分成最多threads段，由各个线程分别调用f(begin, end)，调用者线程处理第一段
+        template <class F>
+        static void parallel_for(size_t n, size_t threads, F f)
+        {
+            threads = std::max((size_t)1, std::min(threads, n));
+            std::vector<std::thread> workers;
+            for (size_t t = 1; t < threads; t++)
+                workers.emplace_back(f, n * t / threads, n * (t + 1) / threads);
+            f((size_t)0, n / threads);
+            for (size_t t = 0; t < workers.size(); t++)
+                workers[t].join();
+        }
+        //将一层结点的索引项（key为子树的最小key）打包成上一层内部结点，由threads个线程写入
+        void bulk_build_level(std::vector<index_t> &level, size_t fill, size_t threads = 1);
+        //把count个元素按每组fill个分组，最后一组过小时与前一组合并或平分
+        std::vector<size_t> bulk_groups(size_t count, size_t fill) const;
+        //插入一批数据项（record_t或std::pair），同一个叶子结点的数据项只读写一次该结点。
+        //已存在的key以及批内重复的key（保留第一个）被跳过，返回实际插入的个数。
+        //有超长的key时整批都不插入，返回-1
+        template <class It>
+        int insert_batch(It first, It last);
+        //将已排序且key不重复的records按叶子结点分组插入，overwrite为真时覆盖已存在的key
+        int upsert_records(const record_t *first, const record_t *last, bool overwrite);
+        //将已排序的records插入至offset处的叶子结点，数据项过多时一次分裂成多个结点
+        int insert_records(off_t offset, const record_t *first, const record_t *last,
+                           bool overwrite = false);
+        //按keys中的key比较下标
+        struct probe_less
+        {
+            const key_t *keys;
+            bool operator()(size_t l, size_t r) const
+            {
+                return keycmp(keys[l], keys[r]) < 0;
+            }
+        };
+        struct record_less
+        {
+            bool operator()(const record_t &l, const record_t &r) const
+            {
+                return keycmp(l.key, r.key) < 0;
+            }
+        };
+        static record_t make_record(const record_t &record)
+        {
+            return record;
+        }
+        template <class K, class V>
+        static record_t make_record(const std::pair<K, V> &pair)
+        {
+            record_t record;
+            record.key = pair.first;
+            record.value = pair.second;
+            return record;
+        }
 
         /*
             *******
             查找相关
             *******
         */
-        //寻找索引key对应位置
-        off_t search_index(const key_t &key) const;
+        //三路比较两个key
+        static int keycmp(const key_t &a, const key_t &b)
+        {
+            return Compare()(a, b);
+        }
+        //按Compare比较的二分查找，元素可以是数据项或索引项
+        struct key_less
+        {
+            template <class T>
+            bool operator()(const T &l, const key_t &r) const
+            {
+                return keycmp(l.key, r) < 0;
+            }
+            template <class T>
+            bool operator()(const key_t &l, const T &r) const
+            {
+                return keycmp(l, r.key) < 0;
+            }
+        };
+        template <class It>
+        static It upper_bound(It first, It last, const key_t &key)
+        {
+            return std::upper_bound(first, last, key, key_less());
+        }
+        template <class It>
+        static It lower_bound(It first, It last, const key_t &key)
+        {
+            return std::lower_bound(first, last, key, key_less());
+        }
+        //结点内的查找只访问连续存放的key数组，叶子结点和内部结点（E为汇总值）的迭代器都由此查找
+        typedef key_search<Key, Compare> search_t;
+        template <class R, class K, class V, class E>
+        static node_iterator<R, K, V, E> upper_bound(node_iterator<R, K, V, E> first,
+                                                     node_iterator<R, K, V, E> last, const key_t &key)
+        {
+            return first + search_t::upper_bound(first.key_ptr(), last - first, key);
+        }
+        template <class R, class K, class V, class E>
+        static node_iterator<R, K, V, E> lower_bound(node_iterator<R, K, V, E> first,
+                                                     node_iterator<R, K, V, E> last, const key_t &key)
+        {
+            return first + search_t::lower_bound(first.key_ptr(), last - first, key);
+        }
+        template <class It>
+        static bool binary_search(It first, It last, const key_t &key)
+        {
+            It it = lower_bound(first, last, key);
+            return it != last && keycmp(it->key, key) == 0;
+        }
+        //在内部结点查找第一个大于key值的对应元素下标
+        static index_iterator find(internal_node_t &node, const key_t &key);
+        static const_index_iterator find(const internal_node_t &node, const key_t &key);
+        //在内部结点中查找指向child的索引项
+        static index_iterator find_child(internal_node_t &node, off_t child);
+        //在叶子结点中查找第一个小于等于key值的对应元素下标
+        static const_record_iterator find(const leaf_node_t &node, const key_t &key);
+        static record_iterator find(leaf_node_t &node, const key_t &key);
+
+        //结点不保存父结点，修改时使用查找过程中记下的路径：
+        //path[0]为根结点，path.back()为叶子结点的父结点
+        typedef std::vector<off_t> path_t;
+        //寻找索引key对应位置，path不为NULL时记下从根结点到该位置的路径
+        off_t search_index(const key_t &key, path_t *path = NULL) const;
+        //在offset处的内部结点中找到key所在的孩子结点，只访问结点的头部、key数组和找到的那个孩子结点，
+        //映射模式下直接在映射中查找。storage为真时绕过pending直接读存储，用于不加锁的查找，
+        //此时结点可能正被修改，映射中只按字原子地复制头部、比较的key和找到的孩子结点，
+        //读到的内容不一致时返回0，调用者需要校验版本号
+        off_t search_child(off_t offset, const key_t &key, bool storage = false) const;
+        //在offset处的叶子结点中查找key，与search_child一样只访问key数组和找到的那个value，返回值同search
+        int search_record(off_t offset, const key_t &key, value_t *value, bool storage = false) const;
+        //在映射中offset处结点的前n个key上查找，upper为真时查找第一个大于key的下标，否则查找第一个不小于key的下标
+        template <bool upper>
+        size_t load_bound(off_t offset, size_t n, const key_t &key) const;
         //寻找叶子结点
         off_t search_leaf(off_t index, const key_t &key) const;
         off_t search_leaf(const key_t &key) const
         {
             return search_leaf(search_index(key), key);
         }
+        //寻找叶子结点，同时给出该叶子结点key值的上界（不存在时bounded为false）
+        off_t search_leaf(const key_t &key, key_t *fence, bool *bounded) const;
 
         /*
             *******
             删除相关
             *******
         */
-        //删除内部结点里对应的key值
-        void remove_from_index(off_t offset, internal_node_t &node,
+        //删除内部结点里对应的key值，结点为path.back()，其上为各层祖先
+        void remove_from_index(path_t &path, internal_node_t &node,
                                const key_t &key);
-        //从内部结点借一个索引项
+        //从内部结点借一个索引项，兄弟结点与borrower在同一个父结点下，level为所在的层
         bool borrow_key(bool from_right, internal_node_t &borrower,
-                        off_t offset);
+                        off_t offset, off_t parent_off, size_t level);
         //从叶子结点借一个数据项
         bool borrow_key(bool from_right, leaf_node_t &borrower);
         //修改一个结点的父结点对应的key
-        void change_parent_child(off_t parent, const key_t &o,
-                                 const key_t &n);
+        void change_parent_child(const key_t &o, const key_t &n);
         //将右边的叶子合并至左边的叶子结点
         void merge_leafs(leaf_node_t *left, leaf_node_t *right);
         //合并内部节点
-        void merge_keys(index_t *where, internal_node_t &left,
-                        internal_node_t &right, bool change_where_key = false);
-        //修改孩子结点的父结点
-        void reset_index_children_parent(index_t *begin, index_t *end,
-                                         off_t parent);
+        void merge_keys(index_iterator where, internal_node_t &left,
+                        internal_node_t &right);
 
         /*
             *******
@@ -160,14 +1133,15 @@ namespace BPT
             *******
         */
         //将一个数据项插入至叶子结点（不包含分裂的情况）
-        void insert_record_no_split(leaf_node_t *leaf,
-                                    const key_t &key, const value_t &value);
-        //将一个索引项插入至内部节点
-        void insert_key_to_index(off_t offset, const key_t &key,
+        //返回新数据项的下标
+        size_t insert_record_no_split(leaf_node_t *leaf,
+                                      const key_t &key, const value_t &value);
+        //将一个索引项插入至内部节点path.back()，分裂时沿path向上插入，path为空时创建新的根结点
+        void insert_key_to_index(path_t &path, const key_t &key,
                                  off_t value, off_t after);
-        //将一个索引项插入至内部节点（不包含分裂的情况）
-        void insert_key_to_index_no_split(internal_node_t &node, const key_t &key,
-                                          off_t value);
+        //将一个索引项插入至内部节点（不包含分裂的情况），返回新索引项的下标
+        size_t insert_key_to_index_no_split(internal_node_t &node, const key_t &key,
+                                            off_t value);
 
 
         template <class T>
@@ -175,22 +1149,207 @@ namespace BPT
         template <class T>
         void node_remove(T *prev, T *node);
 
-        //用于打开关闭文件
-        mutable FILE *fp;
-        mutable int fp_level;
+        /*
+            *******
+            汇总值
+            *******
+        */
+        //内部结点是否保存汇总值，由新建时的options.aggregate决定
+        bool aggregated() const
+        {
+            return meta.aggregate_size != 0;
+        }
+        static aggregate_t aggregate_of(const leaf_node_t &leaf);
+        static aggregate_t aggregate_of(const internal_node_t &node);
+        //在offset处的内部结点中找到key所在孩子结点的下标，只读入头部和key数组
+        size_t search_slot(off_t offset, const key_t &key) const;
+        //B+树结构不变的修改之后，沿path增量更新key所在各棵子树的汇总值：
+        //去掉removed，加上added（为NULL时跳过）。去掉的是最小值或最大值时由孩子结点重新计算
+        void adjust_aggregates(const path_t &path, const key_t &key,
+                               const value_t *removed, const value_t *added);
+        //结构改变过的结点：level为所在的层（叶子结点为0），key落在结点的范围内
+        struct stale_t
+        {
+            size_t level;
+            off_t offset;
+            key_t key;
+        };
+        //结点的内容确定之后记下，修改操作结束时重新计算它在父结点中的汇总值
+        void mark_stale(const leaf_node_t &leaf, off_t offset);
+        void mark_stale(const internal_node_t &node, off_t offset, size_t level);
+        //自下而上逐层重新计算记下的结点及其祖先的汇总值
+        void refresh_aggregates();
+        //从offset处高度为height（叶子结点为0）的子树中汇总不小于bound（upper为真时不大于bound）的数据项
+        void aggregate_edge(off_t offset, size_t height, const key_t &bound, bool upper,
+                            aggregate_t *result) const;
+        //不保存汇总值时沿叶子结点链表扫描[left, right]
+        aggregate_t aggregate_scan(const key_t &left, const key_t &right) const;
+
+        //查找操作共享、修改操作独占整棵B+树。页缓存、文件和日志各自可以被多个线程同时使用，
+        //映射模式下查找直接访问映射，不需要其他同步。
+        //修改之间串行执行，没有按结点加锁（lock crabbing或B-link）：一次修改是一个事务，
+        //改动的页面暂存在整棵树共用的pending中，提交时作为一条日志记录或一批影子页写入，
+        //分配和回收结点、更换根结点以及刷新汇总值都修改同一份元数据。按结点加锁之后两个修改
+        //仍然不能各自提交，需要每个事务自己的页面集合和能排定提交顺序的日志。
+        //修改操作可以与以下操作同时进行：不加锁的单点查找（search）、打开写缓冲时其他线程的
+        //修改（只锁住key所在的分段，由后台线程按批合并），以及WAL_GROUP下其他写者等待日志落盘
+        mutable std::shared_mutex latch;
 
-        void open_file(const char *mode = "rb+") const
+        //search不加锁（乐观读）：每个页面有一个版本号，修改操作在第一次写入页面之前
+        //将其加一变为奇数，提交之后再加一。查找读入结点前后该结点所在页面的版本号
+        //相同且为偶数，并且父结点的版本号仍未改变时，读到的结点才是一致的，否则重新查找
+        mutable std::atomic<uint64_t> versions[BP_VERSION_SLOTS];
+        //当前修改操作锁住（版本号为奇数）的槽，修改操作互斥，由持有latch的写者访问
+        mutable std::vector<size_t> locked;
+        //对外发布的根结点位置和高度，由root_version按同样的方式保护
+        std::atomic<uint64_t> root_version;
+        std::atomic<off_t> root_offset;
+        std::atomic<size_t> root_height;
+
+        //结点所在各页面的版本号
+        struct snapshot_t
+        {
+            off_t offset;
+            size_t size;
+            uint64_t versions[PageSize / BP_PAGE_SIZE + 2];
+        };
+        static size_t slot_of(off_t page)
+        {
+            return (page / BP_PAGE_SIZE) % BP_VERSION_SLOTS;
+        }
+        //修改[offset, offset + size)之前锁住对应的页面
+        void lock_pages(off_t offset, size_t size) const
+        {
+            if (size == 0)
+                return;
+            off_t last = (offset + size - 1) / BP_PAGE_SIZE * BP_PAGE_SIZE;
+            for (off_t page = offset / BP_PAGE_SIZE * BP_PAGE_SIZE; page <= last; page += BP_PAGE_SIZE)
+                lock_slot(slot_of(page));
+        }
+        void lock_slot(size_t slot) const
         {
-            if (fp_level == 0)
-                fp = fopen(path, mode);
-            ++fp_level;
+            if (versions[slot].load(std::memory_order_relaxed) & 1)
+                return;
+            versions[slot].fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            locked.push_back(slot);
         }
+        //整棵B+树被重建时锁住所有页面
+        void lock_all_pages()
+        {
+            for (size_t slot = 0; slot < BP_VERSION_SLOTS; slot++)
+                lock_slot(slot);
+        }
+        //修改操作结束：发布新的根结点，然后释放锁住的页面
+        void unlock_pages();
+        //记录结点所在页面的版本号，有页面正在被修改时返回false
+        bool snapshot(snapshot_t *s, off_t offset, size_t size) const;
+        //读入结点之后检查版本号是否改变
+        bool validate(const snapshot_t &s) const;
+        //不加锁的查找，读到不一致的结点时返回false
+        bool search_optimistic(const key_t &key, value_t *value, int *ret) const;
+        //是否可以不加锁查找：映射模式下需要映射的起始地址固定
+        bool optimistic() const
+        {
+            return !mapped() || mapping.stable();
+        }
+
+        //只访问B+树本身的查找
+        int search_tree(const key_t &key, value_t *value) const;
+        int search_batch_tree(const key_t *keys, size_t n, value_t *values, int *status) const;
+        int search_range_tree(key_t *left, const key_t &right,
+                              value_t *values, size_t max, bool *next) const;
+        //合并写缓冲和B+树的范围查找
+        int search_range_buffered(key_t *left, const key_t &right,
+                                  value_t *values, size_t max, bool *next) const;
+        //从上层内部结点中选出最多parts - 1个落在(left, right]内的分隔key，把范围分成数据量相近的几段
+        std::vector<key_t> split_range(const key_t &left, const key_t &right, size_t parts) const;
+        //沿叶子结点链表扫描[from, to]（inclusive为假时不含to），对每个数据项调用callback(part, key, value)
+        template <class F>
+        size_t scan_part(size_t part, const key_t &from, const key_t &to, bool inclusive, F &callback) const;
+        //读出B+树中[from, right]（skip_from为真时不含from）内最多max个数据项
+        void scan_tree(const key_t &from, bool skip_from, const key_t &right, size_t max,
+                       std::vector<record_t> *records) const;
+        int remove_key(const key_t &key);
 
-        void close_file() const
+        //经由写缓冲的修改
+        enum buffer_op_t
+        {
+            BUFFER_INSERT,
+            BUFFER_UPDATE,
+            BUFFER_REMOVE
+        };
+        int write_buffered(buffer_op_t op, const key_t &key, const value_t &value);
+        std::mutex &key_lock(const key_t &key) const
         {
-            if (fp_level == 1)
-                fclose(fp);
-            --fp_level;
+            return key_locks[checksum(&key, sizeof(key_t)) % BP_KEY_STRIPES];
+        }
+        //唤醒后台线程合并写缓冲
+        void request_drain();
+        void drain_loop();
+
+        typedef BPT::write_buffer<key_t, value_t, Compare> buffer_t;
+        mutable buffer_t buffer;
+        size_t buffer_size;
+        //检查key是否存在和写入缓冲之间不能有同一个key的其他修改
+        mutable std::mutex key_locks[BP_KEY_STRIPES];
+        //合并互斥，后台线程和drain()的调用者一次只有一个在合并
+        std::mutex drain_latch;
+        std::thread drainer;
+        std::mutex drain_mutex;
+        std::condition_variable drain_wake;
+        bool drain_requested;
+        bool drain_stop;
+        //数据库文件，构造时打开，析构时关闭
+        file_t file;
+        storage_mode_t mode;
+        //写前日志，页缓存写回数据页之前经由logged保证日志已经落盘
+        mutable wal_t wal;
+        wal_io logged;
+        //开启日志时，修改操作期间写入的页面先保存在pending中，
+        //操作结束时作为一条日志记录提交，之后才写入存储
+        mutable std::map<off_t, std::vector<char> > pending;
+        int txn_depth;
+        bool shadow_paging;
+        //修改操作是否需要经过pending提交
+        bool transactional() const
+        {
+            return wal.enabled() || shadow_paging;
+        }
+        //修改操作使用的结点帧，只在持有独占时使用
+        mutable node_arena frames;
+        //本次修改操作中结构改变过的结点，只在持有独占时使用
+        std::vector<stale_t> stale;
+        mutable std::atomic<uint64_t> copy_ops;
+        mutable std::atomic<uint64_t> copied_in;
+        mutable std::atomic<uint64_t> copied_out;
+        //STORAGE_CACHE模式下所有结点的读写都经过页缓存
+        mutable buffer_pool cache;
+        //STORAGE_MMAP模式下的文件映射，STORAGE_MEMORY模式下的匿名内存
+        mutable mapping_t mapping;
+        //结点是否直接存放在mapping中
+        bool mapped() const
+        {
+            return mode != STORAGE_CACHE;
+        }
+        //建立mapping：映射数据库文件或分配匿名内存
+        int map_storage()
+        {
+            return mode == STORAGE_MEMORY ? mapping.map_anonymous() : mapping.map(&file);
+        }
+        //已分配的空间全部可以直接写入：映射模式下预先扩展映射，多个线程写入时不必扩展
+        int reserve_storage()
+        {
+            return mapped() ? mapping.grow(meta.slot) : 0;
+        }
+        //将path处快照文件的内容复制到内存中
+        int load_snapshot(const char *path);
+        static options_t memory_options(options_t options)
+        {
+            options.mode = STORAGE_MEMORY;
+            options.wal = WAL_OFF;
+            options.shadow_paging = false;
+            return options;
         }
 
         //为节点分配磁盘空间
@@ -200,57 +1359,332 @@ namespace BPT
             meta.slot += size;
             return slot;
         }
+        //优先复用空闲链表中的结点，空闲结点之间通过next串联
+        template <class T>
+        off_t alloc(off_t *free_list)
+        {
+            if (*free_list == 0)
+                return alloc(size_of((T *)NULL));
+            off_t slot = *free_list;
+            read(free_list, slot + offsetof(T, next), sizeof(off_t));
+            return slot;
+        }
+        template <class T>
+        void unalloc(off_t *free_list, off_t offset)
+        {
+            write(free_list, offset + offsetof(T, next), sizeof(off_t));
+            *free_list = offset;
+        }
         off_t alloc(leaf_node_t *leaf)
         {
             leaf->n = 0;
+            leaf->order = meta.order;
             meta.leaf_node_num++;
-            return alloc(sizeof(leaf_node_t));
+            return alloc<leaf_node_t>(&meta.free_leaf);
         }
         off_t alloc(internal_node_t *node)
         {
             node->n = 1;
+            node->order = meta.order;
             meta.internal_node_num++;
-            return alloc(sizeof(internal_node_t));
+            return alloc<internal_node_t>(&meta.free_internal);
         }
+        //回收结点，调用者负责随后写回meta
         void unalloc(leaf_node_t *leaf, off_t offset)
         {
             --meta.leaf_node_num;
+            unalloc<leaf_node_t>(&meta.free_leaf, offset);
         }
 
         void unalloc(internal_node_t *node, off_t offset)
         {
             --meta.internal_node_num;
+            unalloc<internal_node_t>(&meta.free_internal, offset);
         }
 
+        //一次修改操作：独占B+树，结束时提交。写前日志在释放独占之后才等待落盘，
+        //同时提交的写者可以共用一次fdatasync。修改操作之间不能嵌套调用
+        struct txn_t
+        {
+            basic_bpt *tree;
+            std::unique_lock<std::shared_mutex> lock;
+            explicit txn_t(basic_bpt *tree) : tree(tree), lock(tree->latch)
+            {
+                if (tree->txn_depth++ == 0)
+                    tree->copy_ops.fetch_add(1, std::memory_order_relaxed);
+            }
+            ~txn_t()
+            {
+                if (tree->txn_depth == 1)
+                    tree->refresh_aggregates();
+                uint64_t lsn = tree->commit();
+                tree->unlock_pages();
+                lock.unlock();
+                if (lsn != 0)
+                    tree->wal.commit(lsn);
+            }
+        };
+        //提交pending中的页面，返回还需要等待落盘的日志lsn，不需要等待时返回0
+        uint64_t commit();
+        //影子分页的提交：影子页和上一批写回的页面落盘后写入新的元数据。
+        //这是页面镜像的双写，而不是把修改的结点写到新位置再切换根结点的写时复制：
+        //结点之间有兄弟指针（游标、范围查找和预读都沿它们访问），搬动一个结点要改写两侧的
+        //兄弟，写时复制下它们也要搬动，连锁波及整层结点。代价是不给并发的读者保留旧版本，
+        //一致性不受影响：修改独占latch，页面写回原位置时版本号为奇数，不加锁的查找会重试。
+        //需要某一时刻的一致副本时使用snapshot()
+        int commit_shadow();
+        //元数据的generation加一，带校验和写入对应的一份并落盘
+        int commit_meta();
+        //读取两份元数据中有效且较新的一份，都无效时使用第一份
+        int load_meta();
+        //写回最后一次提交的影子页；不再使用影子分页时改回只用第一份元数据
+        void recover_shadow();
+        //把一个页面写回原位置，第0页中的元数据单独提交，不被覆盖
+        void install_page(off_t page, const char *data) const
+        {
+            if (page == OFFSET_META)
+                write_storage(data + OFFSET_BLOCK, OFFSET_BLOCK, BP_PAGE_SIZE - OFFSET_BLOCK);
+            else
+                write_storage(data, page, BP_PAGE_SIZE);
+        }
+        static uint64_t meta_checksum(meta_t meta)
+        {
+            meta.checksum = 0;
+            return checksum(&meta, sizeof(meta_t));
+        }
+        //写回所有修改并将数据文件落盘
+        int sync_storage() const
+        {
+            int ret = flush();
+            if (mapped())
+                ret |= mapping.sync();
+            else
+                ret |= file.sync();
+            return ret;
+        }
+        //读写pending中的页面，不在其中的页面先从存储中读入
+        int read_pending(void *block, off_t offset, size_t size) const;
+        int write_pending(const void *block, off_t offset, size_t size) const;
+
         //读磁盘、写磁盘
         int read(void *block, off_t offset, size_t size) const
         {
-            open_file();
-            fseek(fp, offset, SEEK_SET);
-            size_t rd = fread(block, size, 1, fp);
-            close_file();
-            return rd - 1;
+            if (!pending.empty())
+                return read_pending(block, offset, size);
+            return read_storage(block, offset, size);
+        }
+        int read_storage(void *block, off_t offset, size_t size) const
+        {
+            if (mapped())
+                return mapping.read(block, offset, size);
+            return cache.read(block, offset, size);
+        }
+        //结点在磁盘上占用的大小由阶数决定，其余结构按实际大小读写
+        size_t size_of(const leaf_node_t *) const
+        {
+            return leaf_node_t::size_at(meta.order);
+        }
+        size_t size_of(const internal_node_t *) const
+        {
+            return internal_node_t::size_at(meta.order, aggregated());
+        }
+        template <class T>
+        size_t size_of(const T *) const
+        {
+            return sizeof(T);
+        }
+        //结点的value（孩子结点）数组
+        value_t *tail_of(leaf_node_t *node) const
+        {
+            return node->values();
+        }
+        const value_t *tail_of(const leaf_node_t *node) const
+        {
+            return node->values();
+        }
+        off_t *tail_of(internal_node_t *node) const
+        {
+            return node->children();
+        }
+        const off_t *tail_of(const internal_node_t *node) const
+        {
+            return node->children();
         }
+        //内部结点的汇总值数组的大小，不保存汇总值时为0
+        size_t extra_of(const internal_node_t *) const
+        {
+            return meta.order * meta.aggregate_size;
+        }
+        template <class T>
+        size_t extra_of(const T *) const
+        {
+            return 0;
+        }
+        aggregate_t *extra_ptr(internal_node_t *node) const
+        {
+            return node->aggs();
+        }
+        template <class T>
+        T *extra_ptr(T *block) const
+        {
+            return block;
+        }
+
         template <class T>
         int read(T *block, off_t offset) const
         {
-            return read(block, offset, sizeof(T));
+            return read(block, offset, size_of(block));
         }
 
-        int write(void *block, off_t offset, size_t size) const
+        //修改操作使用的结点帧，在调用者的node_arena::scope_t结束时释放。
+        //帧中的数组按当前的阶数存放
+        template <class T>
+        T &frame() const
+        {
+            T *node = new (frames.alloc()) T;
+            node->order = meta.order;
+            return *node;
+        }
+        //修改路径上读入结点，计入复制的字节数
+        template <class T>
+        int fetch(T *block, off_t offset) const
+        {
+            copied_in.fetch_add(size_of(block), std::memory_order_relaxed);
+            return read(block, offset);
+        }
+        int fetch(void *block, off_t offset, size_t size) const
+        {
+            copied_in.fetch_add(size, std::memory_order_relaxed);
+            return read(block, offset, size);
+        }
+        //修改路径上只读访问结点，可以直接访问时不复制
+        template <class T>
+        const T *view(T *buf, off_t offset) const
+        {
+            const T *node = peek(buf, offset);
+            if (node == buf)
+                copied_in.fetch_add(size_of(buf), std::memory_order_relaxed);
+            return node;
+        }
+        //确定要修改view得到的结点时将其复制到buf，已在buf中时不再复制
+        template <class T>
+        void materialize(T *buf, const T *node, off_t offset) const
+        {
+            if (node != buf)
+                fetch(buf, offset);
+        }
+        //offset处结点的第i个key、第i个value（孩子结点）在磁盘上的位置
+        off_t key_at(off_t offset, size_t i) const
+        {
+            return offset + SIZE_NO_CHILDREN + i * sizeof(key_t);
+        }
+        off_t payload_at(const leaf_node_t *, off_t offset, size_t i) const
+        {
+            return offset + leaf_node_t::values_at(meta.order) + i * sizeof(value_t);
+        }
+        off_t payload_at(const internal_node_t *, off_t offset, size_t i) const
+        {
+            return offset + internal_node_t::children_at(meta.order) + i * sizeof(off_t);
+        }
+        //offset处内部结点第i个孩子结点的汇总值在磁盘上的位置
+        off_t aggregate_at(off_t offset, size_t i) const
+        {
+            return offset + internal_node_t::aggs_at(meta.order) + i * sizeof(aggregate_t);
+        }
+        //只写回结点头部和下标[from, to)的key与value（孩子结点、汇总值），结点的其余部分没有改变
+        template <class T>
+        int write_entries(T *node, off_t offset, size_t from, size_t to) const
         {
-            open_file();
-            fseek(fp, offset, SEEK_SET);
-            size_t wd = fwrite(block, size, 1, fp);
-            close_file();
-            return wd - 1;
+            int ret = write(node, offset, SIZE_NO_CHILDREN);
+            if (ret == 0 && from < to)
+                ret = write(&node->keys[from], key_at(offset, from), (to - from) * sizeof(key_t));
+            if (ret == 0 && from < to)
+                ret = write(&tail_of(node)[from], payload_at(node, offset, from),
+                            (to - from) * sizeof(*tail_of(node)));
+            if (ret == 0 && from < to && extra_of(node) > 0)
+                ret = write(&extra_ptr(node)[from], aggregate_at(offset, from),
+                            (to - from) * sizeof(aggregate_t));
+            return ret;
+        }
+
+        int write(const void *block, off_t offset, size_t size) const
+        {
+            if (txn_depth > 0)
+            {
+                lock_pages(offset, size);
+                copied_out.fetch_add(size, std::memory_order_relaxed);
+            }
+            if (txn_depth > 0 && transactional())
+            {
+                //影子分页的元数据在提交时写入
+                if (shadow_paging && offset == OFFSET_META)
+                    return 0;
+                return write_pending(block, offset, size);
+            }
+            return write_storage(block, offset, size);
+        }
+        int write_storage(const void *block, off_t offset, size_t size) const
+        {
+            if (mapped())
+                return mapping.write(block, offset, size);
+            return cache.write(block, offset, size);
+        }
+
+        //即将访问next处的叶子结点。叶子结点在文件中按扫描方向连续存放时，
+        //提示系统预读其后的若干个结点，预读深度随连续访问的次数加倍
+        void read_ahead(readahead_t &ra, off_t next, bool forward) const;
+        int advise(off_t offset, size_t size) const
+        {
+            if (mapped())
+                return mapping.advise(offset, size);
+            return file.advise(offset, size);
+        }
+
+        //只读访问一个结点：映射模式下直接返回结点在映射中的地址，否则将结点读入buf并返回buf。
+        //返回的指针在下一次写入前有效。结构体中阶数之后预留的部分可能被读到（如不保存汇总值时
+        //迭代器引用的汇总值），结点靠近映射末尾时仍然读入buf
+        template <class T>
+        const T *peek(T *buf, off_t offset) const
+        {
+            if (mapped() && pending.empty() &&
+                offset + sizeof(T) <= mapping.length.load(std::memory_order_relaxed))
+                return (const T *)mapping.at(offset);
+            read(buf, offset);
+            return buf;
+        }
+
+        //将页缓存中的脏页写回磁盘，映射模式下数据已在系统缓存中
+        int flush() const
+        {
+            if (mapped())
+                return 0;
+            return cache.flush();
         }
 
         template <class T>
         int write(T *block, off_t offset) const
         {
-            return write(block, offset, sizeof(T));
+            return write(block, offset, size_of(block));
         }
+
+    private:
+        basic_bpt(const basic_bpt &);
+        basic_bpt &operator=(const basic_bpt &);
     };
+
+    //默认使用16字节的字符串作为key，int作为value
+    typedef basic_bpt<key_t, value_t> bpt;
+    typedef bpt::index_t index_t;
+    typedef bpt::record_t record_t;
+    typedef bpt::internal_node_t internal_node_t;
+    typedef bpt::leaf_node_t leaf_node_t;
+}
+
+#include "bpt_impl.h"
+
+namespace BPT
+{
+    //默认的B+树在bpt.cpp中实例化
+    extern template class basic_bpt<key_t, value_t>;
 }
 #endif
\ No newline at end of file
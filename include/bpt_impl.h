@@ -0,0 +1,2814 @@
+#ifndef BPT_IMPL_H
+#define BPT_IMPL_H
+
+//basic_bpt的实现，由bpt.h包含
+#include <unistd.h>
+#include <algorithm>
+
+namespace BPT
+{
+#define BPT_TEMPLATE template <class Key, class Value, class Compare, size_t PageSize>
+#define BPT_CLASS basic_bpt<Key, Value, Compare, PageSize>
+
+    /*
+    *******
+    辅助函数
+    *******
+    */
+    //获取结点内第一个元素的迭代器，以及最后一个元素向后一位的迭代器。
+    template <class T>
+    inline typename T::child_t begin(T &node)
+    {
+        return node.begin();
+    }
+
+    template <class T>
+    inline typename T::child_t end(T &node)
+    {
+        return node.begin() + node.n;
+    }
+
+    template <class T>
+    inline typename T::const_child_t begin(const T &node)
+    {
+        return node.begin();
+    }
+
+    template <class T>
+    inline typename T::const_child_t end(const T &node)
+    {
+        return node.begin() + node.n;
+    }
+
+    //构造函数
+    BPT_TEMPLATE
+    BPT_CLASS::basic_bpt(const char *p, bool force_empty, const options_t &options)
+        : root_version(0), root_offset(0), root_height(0),
+          buffer_size(options.buffer_size), drain_requested(false), drain_stop(false),
+          mode(options.mode), logged(&file, &wal), txn_depth(0),
+          shadow_paging(options.shadow_paging && options.mode != STORAGE_MEMORY),
+          frames(std::max(sizeof(leaf_node_t), sizeof(internal_node_t))),
+          copy_ops(0), copied_in(0), copied_out(0),
+          cache(&logged, options.mode == STORAGE_CACHE ? options.cache_pages : 1)
+    {
+        for (size_t i = 0; i < BP_VERSION_SLOTS; i++)
+            versions[i].store(0, std::memory_order_relaxed);
+        bzero(path, sizeof(path));
+        strcpy(path, p);
+
+        if (mode == STORAGE_MEMORY)
+        {
+            //内存模式不打开数据库文件，path只用于载入快照
+            map_storage();
+            if (force_empty || path[0] == '\0' || load_snapshot(path) != 0)
+                force_empty = true;
+        }
+        else
+            file.open(path, options.direct_io && mode == STORAGE_CACHE);
+        //重做上次未做检查点的修改，不再使用日志时删除日志文件
+        char wal_path[sizeof(path) + 4];
+        snprintf(wal_path, sizeof(wal_path), "%s.wal", path);
+        wal_mode_t wal_mode = shadow_paging ? WAL_OFF : options.wal;
+        if (mode != STORAGE_MEMORY && (wal_mode != WAL_OFF || access(wal_path, F_OK) == 0))
+        {
+            wal.open(wal_path, wal_mode);
+            if (!force_empty && wal.replay(&file) > 0)
+                file.sync();
+            wal.reset();
+            if (wal_mode == WAL_OFF)
+            {
+                wal.close();
+                unlink(wal_path);
+            }
+        }
+        if (mode == STORAGE_MMAP)
+        {
+            //映射时文件会被扩展，需要先检查文件中是否已有元数据
+            if (file.size() < (off_t)(OFFSET_BLOCK))
+                force_empty = true;
+            else
+                mapping.map(&file);
+        }
+        if (!force_empty)
+        {
+            //如果不为0，代表文件已经出错。
+            if (load_meta() != 0)
+                force_empty = true;
+            //文件中的结点格式与当前程序不兼容时同样视为出错
+            else if (meta.format != BP_FORMAT_VERSION ||
+                     meta.order < BP_MIN_ORDER ||
+                     meta.order > order_of_page(PageSize, meta.aggregate_size != 0) ||
+                     meta.key_size != sizeof(key_t) || meta.value_size != sizeof(value_t) ||
+                     (meta.aggregate_size != 0 && meta.aggregate_size != sizeof(aggregate_t)))
+                force_empty = true;
+            else
+                recover_shadow();
+        }
+        if (force_empty)
+        {
+            truncate_file();
+            size_t order = options.page_size != 0 ? order_of_page(options.page_size, options.aggregate)
+                                                  : options.order;
+            //带汇总值的内部结点更大，阶数还要受PageSize能容纳的汇总项限制
+            size_t limit = order_of_page(PageSize, options.aggregate);
+            init_from_empty(std::max((size_t)BP_MIN_ORDER, std::min(order, limit)),
+                            options.aggregate);
+            //新建的B+树没有写日志，直接落盘
+            if (transactional())
+                make_checkpoint();
+        }
+        unlock_pages();
+        if (buffer_size > 0)
+            drainer = std::thread(&basic_bpt::drain_loop, this);
+    }
+    BPT_TEMPLATE
+    BPT_CLASS::basic_bpt(const options_t &options)
+        : basic_bpt("", true, memory_options(options))
+    {
+    }
+    //析构时合并写缓冲并将脏页写回，开启日志或影子分页时做检查点
+    BPT_TEMPLATE
+    BPT_CLASS::~basic_bpt()
+    {
+        if (drainer.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(drain_mutex);
+                drain_stop = true;
+            }
+            drain_wake.notify_all();
+            drainer.join();
+        }
+        drain();
+        if (transactional())
+            make_checkpoint();
+        else
+            flush();
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::truncate_file()
+    {
+        //不加锁的查找可能正在访问映射，映射模式下保留原有的映射和文件长度，
+        //其中的内容随后被覆盖
+        if (!mapped() || !mapping.stable())
+        {
+            mapping.unmap();
+            if (mode != STORAGE_MEMORY)
+                file.truncate();
+        }
+        else
+        {
+            //备份的元数据不会被新建的B+树覆盖，清除以免打开时被当作较新的一份
+            meta_t backup;
+            bzero(&backup, sizeof(meta_t));
+            write_storage(&backup, OFFSET_META_BACKUP, sizeof(meta_t));
+        }
+        //旧的日志记录不能重做到截断后的文件上。影子分页不打开日志，不能清空
+        if (transactional())
+            file.sync();
+        if (wal.enabled())
+            wal.reset();
+        cache.reset();
+        if (mapped() && mapping.base == NULL)
+            map_storage();
+    }
+    BPT_TEMPLATE
+    int BPT_CLASS::make_checkpoint()
+    {
+        //日志先落盘，页缓存写回时就不必再等待日志
+        if (wal.sync() != 0)
+            return -1;
+        if (sync_storage() != 0)
+            return -1;
+        //所有页面都已在原位置落盘，影子区不再需要写回
+        if (shadow_paging)
+        {
+            meta.shadow_pages = 0;
+            return commit_meta();
+        }
+        return wal.enabled() ? wal.reset() : 0;
+    }
+    BPT_TEMPLATE
+    int BPT_CLASS::snapshot(const char *to)
+    {
+        drain();
+        std::shared_lock<std::shared_mutex> lock(latch);
+        file_t out;
+        if (out.open(to) != 0 || out.truncate() != 0)
+            return -1;
+        //修改操作结束时页面都已写入存储，直接按存储中的布局复制
+        std::vector<char> block(BP_SNAPSHOT_CHUNK);
+        for (off_t pos = 0; pos < meta.slot; pos += block.size())
+        {
+            size_t size = std::min((off_t)block.size(), meta.slot - pos);
+            if (read_storage(block.data(), pos, size) != 0 ||
+                out.write_page(block.data(), pos, size) != (ssize_t)size)
+                return -1;
+        }
+        //快照中没有影子页，元数据按从未提交过的状态写入
+        meta_t clean = meta, backup;
+        bzero(clean.shadow_area, sizeof(clean.shadow_area));
+        bzero(clean.shadow_capacity, sizeof(clean.shadow_capacity));
+        clean.shadow_pages = clean.generation = clean.checksum = 0;
+        bzero(&backup, sizeof(meta_t));
+        if (out.write_page(&clean, OFFSET_META, sizeof(meta_t)) != (ssize_t)sizeof(meta_t) ||
+            out.write_page(&backup, OFFSET_META_BACKUP, sizeof(meta_t)) != (ssize_t)sizeof(meta_t))
+            return -1;
+        return out.sync();
+    }
+    BPT_TEMPLATE
+    int BPT_CLASS::load_snapshot(const char *from)
+    {
+        if (access(from, F_OK) != 0)
+            return -1;
+        file_t in;
+        if (in.open(from) != 0)
+            return -1;
+        off_t end = in.size();
+        if (end < (off_t)OFFSET_BLOCK)
+            return -1;
+        std::vector<char> block(BP_SNAPSHOT_CHUNK);
+        for (off_t pos = 0; pos < end; pos += block.size())
+        {
+            size_t size = std::min((off_t)block.size(), end - pos);
+            if (in.read_page(block.data(), pos, size) != (ssize_t)size ||
+                mapping.write(block.data(), pos, size) != 0)
+                return -1;
+        }
+        return 0;
+    }
+    BPT_TEMPLATE
+    int BPT_CLASS::load_meta()
+    {
+        meta_t slots[2];
+        if (read(&slots[0], OFFSET_META) != 0)
+            return -1;
+        bool backup = read(&slots[1], OFFSET_META_BACKUP) == 0;
+        int best = 0;
+        uint64_t generation = 0;
+        for (int i = 0; i < (backup ? 2 : 1); i++)
+            if (slots[i].generation > generation && slots[i].checksum == meta_checksum(slots[i]))
+            {
+                best = i;
+                generation = slots[i].generation;
+            }
+        meta = slots[best];
+        return 0;
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::recover_shadow()
+    {
+        //影子页先于元数据落盘，所以都是完整的，重复写回也没有影响
+        if (meta.generation > 0 && meta.shadow_pages > 0)
+        {
+            std::vector<char> page(BP_PAGE_SIZE);
+            off_t pos = meta.shadow;
+            for (size_t i = 0; i < meta.shadow_pages; i++)
+            {
+                off_t home;
+                read_storage(&home, pos, sizeof(off_t));
+                read_storage(page.data(), pos + sizeof(off_t), BP_PAGE_SIZE);
+                install_page(home, page.data());
+                pos += sizeof(off_t) + BP_PAGE_SIZE;
+            }
+            sync_storage();
+        }
+        if (shadow_paging || meta.generation == 0)
+            return;
+        meta_t backup;
+        bzero(&backup, sizeof(meta_t));
+        bzero(meta.shadow_area, sizeof(meta.shadow_area));
+        bzero(meta.shadow_capacity, sizeof(meta.shadow_capacity));
+        meta.shadow_pages = meta.generation = meta.checksum = 0;
+        write_storage(&meta, OFFSET_META, sizeof(meta_t));
+        write_storage(&backup, OFFSET_META_BACKUP, sizeof(meta_t));
+        sync_storage();
+    }
+    BPT_TEMPLATE
+    int BPT_CLASS::commit_meta()
+    {
+        meta.generation++;
+        meta.checksum = meta_checksum(meta);
+        write_storage(&meta, meta.generation % 2 ? OFFSET_META_BACKUP : OFFSET_META, sizeof(meta_t));
+        return sync_storage();
+    }
+    BPT_TEMPLATE
+    int BPT_CLASS::commit_shadow()
+    {
+        //第k次提交使用第k%2块影子区，其中第k-2次提交的页面已在上一次提交时落盘
+        const size_t entry = sizeof(off_t) + BP_PAGE_SIZE;
+        int area = (meta.generation + 1) % 2;
+        if (meta.shadow_capacity[area] < pending.size())
+        {
+            //影子区不够时在文件末尾重新分配。原来的影子区中是第k-2次提交的页面，已经写回，
+            //把它分成空闲的叶子结点，修改的空闲链表同样放在这一批影子页中
+            off_t old = meta.shadow_area[area];
+            off_t old_end = old + meta.shadow_capacity[area] * entry;
+            const off_t leaf_size = size_of((leaf_node_t *)NULL);
+            for (; old != 0 && old + leaf_size <= old_end; old += leaf_size)
+            {
+                write_pending(&meta.free_leaf, old + offsetof(leaf_node_t, next), sizeof(off_t));
+                meta.free_leaf = old;
+            }
+            //影子区按页对齐并占满首尾的页面，其中的页面不会同时存放结点，
+            //提交后写回结点所在的页面时不会覆盖刚落盘的影子页
+            size_t capacity = std::max(pending.size(), meta.shadow_capacity[area] * 2);
+            size_t size = (capacity * entry + BP_PAGE_SIZE - 1) / BP_PAGE_SIZE * BP_PAGE_SIZE;
+            meta.slot = (meta.slot + BP_PAGE_SIZE - 1) / BP_PAGE_SIZE * BP_PAGE_SIZE;
+            meta.shadow_area[area] = alloc(size);
+            meta.shadow_capacity[area] = size / entry;
+        }
+        off_t pos = meta.shadow_area[area];
+        typename std::map<off_t, std::vector<char> >::const_iterator it;
+        for (it = pending.begin(); it != pending.end(); ++it, pos += entry)
+        {
+            write_storage(&it->first, pos, sizeof(off_t));
+            write_storage(it->second.data(), pos + sizeof(off_t), BP_PAGE_SIZE);
+        }
+        //影子页与上一次提交写回的页面一起落盘，然后切换元数据
+        int ret = sync_storage();
+        meta.shadow = meta.shadow_area[area];
+        meta.shadow_pages = pending.size();
+        if (ret == 0)
+            ret = commit_meta();
+
+        for (it = pending.begin(); it != pending.end(); ++it)
+            install_page(it->first, it->second.data());
+        pending.clear();
+        return ret;
+    }
+    /*
+    *******
+    写前日志
+    *******
+    */
+    BPT_TEMPLATE
+    uint64_t BPT_CLASS::commit()
+    {
+        if (--txn_depth > 0 || pending.empty())
+            return 0;
+        if (shadow_paging)
+        {
+            commit_shadow();
+            return 0;
+        }
+
+        std::vector<off_t> offsets;
+        std::vector<const char *> pages;
+        typename std::map<off_t, std::vector<char> >::const_iterator it;
+        for (it = pending.begin(); it != pending.end(); ++it)
+        {
+            offsets.push_back(it->first);
+            pages.push_back(it->second.data());
+        }
+        uint64_t lsn = wal.append(offsets.data(), pages.data(), offsets.size());
+        //映射中的页面随时可能被系统写回，只能等日志落盘之后再写入。WAL_ASYNC提交时
+        //不等待落盘，所以这里总是刷盘；页缓存在写回之前会保证日志落盘，可以先写入，
+        //释放独占之后再按日志模式等待
+        if (mapped())
+        {
+            wal.sync();
+            lsn = 0;
+        }
+        for (it = pending.begin(); it != pending.end(); ++it)
+            write_storage(it->second.data(), it->first, BP_PAGE_SIZE);
+        pending.clear();
+        if (wal.size() > BP_WAL_CHECKPOINT_SIZE)
+            make_checkpoint();
+        return lsn;
+    }
+    BPT_TEMPLATE
+    int BPT_CLASS::read_pending(void *block, off_t offset, size_t size) const
+    {
+        char *dst = (char *)block;
+        while (size > 0)
+        {
+            off_t page = offset - offset % BP_PAGE_SIZE;
+            size_t in = offset - page;
+            size_t n = std::min(size, (size_t)BP_PAGE_SIZE - in);
+
+            typename std::map<off_t, std::vector<char> >::const_iterator it = pending.find(page);
+            if (it != pending.end())
+                memcpy(dst, it->second.data() + in, n);
+            else if (read_storage(dst, offset, n) != 0)
+                return -1;
+
+            dst += n;
+            offset += n;
+            size -= n;
+        }
+        return 0;
+    }
+    BPT_TEMPLATE
+    int BPT_CLASS::write_pending(const void *block, off_t offset, size_t size) const
+    {
+        const char *src = (const char *)block;
+        while (size > 0)
+        {
+            off_t page = offset - offset % BP_PAGE_SIZE;
+            size_t in = offset - page;
+            size_t n = std::min(size, (size_t)BP_PAGE_SIZE - in);
+
+            std::vector<char> &data = pending[page];
+            if (data.empty())
+            {
+                //第一次修改该页面时读入原有内容，超出文件末尾的部分为0
+                data.resize(BP_PAGE_SIZE);
+                if (mapped())
+                {
+                    if ((size_t)page < mapping.length)
+                        mapping.read(data.data(), page, BP_PAGE_SIZE);
+                }
+                else
+                {
+                    char *frame = cache.pin(page);
+                    if (frame == NULL)
+                    {
+                        pending.erase(page);
+                        return -1;
+                    }
+                    memcpy(data.data(), frame, BP_PAGE_SIZE);
+                    cache.unpin(page, false);
+                }
+            }
+            memcpy(data.data() + in, src, n);
+
+            src += n;
+            offset += n;
+            size -= n;
+        }
+        return 0;
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::reset_meta(size_t order, bool aggregated)
+    {
+        bzero(&meta, sizeof(meta_t));
+        meta.format = BP_FORMAT_VERSION;
+        meta.order = order;
+        meta.value_size = sizeof(value_t);
+        meta.key_size = sizeof(key_t);
+        meta.aggregate_size = aggregated ? sizeof(aggregate_t) : 0;
+        meta.slot = OFFSET_BLOCK;
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::init_from_empty(size_t order, bool aggregated)
+    {
+        //初始化b+树元数据
+        reset_meta(order, aggregated);
+        meta.height = 1;
+        //初始化根结点
+        internal_node_t root;
+        root.next = root.prev = 0;
+        meta.root_offset = alloc(&root);
+        root.aggs()[0] = aggregate_t();
+        //初始化一个空的叶结点
+        leaf_node_t leaf;
+        leaf.next = leaf.prev = 0;
+        meta.leaf_offset = root.children()[0] = alloc(&leaf);
+        //保存上述数据至磁盘
+        write(&meta, OFFSET_META);
+        write(&root, meta.root_offset);
+        write(&leaf, root.children()[0]);
+    }
+
+    //在内部结点查找第一个大于key值的对应元素下标
+    BPT_TEMPLATE
+    typename BPT_CLASS::index_iterator BPT_CLASS::find(internal_node_t &node, const key_t &key)
+    {
+        return upper_bound(begin(node), end(node) - 1, key);
+    }
+    BPT_TEMPLATE
+    typename BPT_CLASS::const_index_iterator BPT_CLASS::find(const internal_node_t &node, const key_t &key)
+    {
+        return upper_bound(begin(node), end(node) - 1, key);
+    }
+    //在内部结点中查找指向child的索引项
+    BPT_TEMPLATE
+    typename BPT_CLASS::index_iterator BPT_CLASS::find_child(internal_node_t &node, off_t child)
+    {
+        index_iterator where = begin(node);
+        while (where != end(node) - 1 && where->child != child)
+            ++where;
+        return where;
+    }
+    //在叶子结点中查找第一个小于等于key值的对应元素下标
+    BPT_TEMPLATE
+    typename BPT_CLASS::const_record_iterator BPT_CLASS::find(const leaf_node_t &node, const key_t &key)
+    {
+        return lower_bound(begin(node), end(node), key);
+    }
+    BPT_TEMPLATE
+    typename BPT_CLASS::record_iterator BPT_CLASS::find(leaf_node_t &node, const key_t &key)
+    {
+        return lower_bound(begin(node), end(node), key);
+    }
+
+    /*
+        *******
+        查找相关
+        *******
+    */
+    //先查找写缓冲，不在其中时再查找B+树
+    BPT_TEMPLATE
+    int BPT_CLASS::search(const key_t &key, value_t *value) const
+    {
+        if (buffer_size == 0)
+            return search_tree(key, value);
+        typename buffer_t::guard_t guard(buffer);
+        int state = buffer.get(key, value);
+        if (state >= 0)
+            return state == 0 ? 0 : -1;
+        return search_tree(key, value);
+    }
+    //从根结点开始查找。大多数查找不加锁完成，连续遇到修改时改为加共享锁，
+    //避免在频繁修改的结点上一直重试
+    BPT_TEMPLATE
+    int BPT_CLASS::search_tree(const key_t &key, value_t *value) const
+    {
+        if (optimistic())
+            for (int i = 0; i < BP_OPTIMISTIC_RETRIES; i++)
+            {
+                int ret;
+                if (search_optimistic(key, value, &ret))
+                    return ret;
+            }
+
+        std::shared_lock<std::shared_mutex> lock(latch);
+        return search_record(search_leaf(key), key, value);
+    }
+
+    BPT_TEMPLATE
+    bool BPT_CLASS::search_optimistic(const key_t &key, value_t *value, int *ret) const
+    {
+        uint64_t version = root_version.load(std::memory_order_acquire);
+        if (version & 1)
+            return false;
+        off_t org = root_offset.load(std::memory_order_relaxed);
+        size_t height = root_height.load(std::memory_order_relaxed);
+        const size_t index_size = size_of((internal_node_t *)NULL);
+        const size_t leaf_size = size_of((leaf_node_t *)NULL);
+
+        //读完根结点之后根结点没有改变，才能确定读到的是当时的根结点
+        snapshot_t parent, child;
+        if (!snapshot(&parent, org, index_size))
+            return false;
+        off_t next = search_child(org, key, true);
+        if (!validate(parent) || next == 0)
+            return false;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (root_version.load(std::memory_order_relaxed) != version)
+            return false;
+
+        //记录子结点的版本号之后父结点没有改变，子结点就没有被移动或回收
+        while (--height > 0)
+        {
+            org = next;
+            if (!snapshot(&child, org, index_size) || !validate(parent))
+                return false;
+            next = search_child(org, key, true);
+            if (!validate(child) || next == 0)
+                return false;
+            parent = child;
+        }
+
+        if (!snapshot(&child, next, leaf_size) || !validate(parent))
+            return false;
+        *ret = search_record(next, key, value, true);
+        return validate(child);
+    }
+    BPT_TEMPLATE
+    off_t BPT_CLASS::search_child(off_t offset, const key_t &key, bool storage) const
+    {
+        //磁盘上孩子结点数组在meta.order个key之后，只读入key时读到keys_size为止
+        const size_t keys_size = SIZE_NO_CHILDREN + meta.order * sizeof(key_t);
+        const size_t children_at = internal_node_t::children_at(meta.order);
+        off_t child = 0;
+        if (mapped() && !storage && pending.empty())
+        {
+            if (offset + size_of((internal_node_t *)NULL) > mapping.length.load(std::memory_order_acquire))
+                return 0;
+            const char *node = mapping.at(offset);
+            size_t n = ((const internal_node_t *)node)->n;
+            if (n == 0 || n > meta.order)
+                return 0;
+            size_t i = search_t::upper_bound((const key_t *)(node + SIZE_NO_CHILDREN), n - 1, key);
+            memcpy(&child, node + children_at + i * sizeof(off_t), sizeof(off_t));
+            return child;
+        }
+
+        //只读入头部和key数组，不构造结点结构体
+        alignas(internal_node_t) char buf[sizeof(internal_node_t)];
+        const internal_node_t *node = (const internal_node_t *)buf;
+        if (mapped() && storage)
+        {
+            //不加锁时结点可能正被修改，只从映射中复制头部、比较的key和找到的孩子结点
+            if (offset + size_of((internal_node_t *)NULL) > mapping.length.load(std::memory_order_acquire))
+                return 0;
+            mapping_t::load_words(buf, mapping.at(offset), SIZE_NO_CHILDREN);
+            if (node->n == 0 || node->n > meta.order)
+                return 0;
+            size_t i = load_bound<true>(offset, node->n - 1, key);
+            mapping_t::load_words(&child, mapping.at(offset + children_at + i * sizeof(off_t)), sizeof(off_t));
+            return child;
+        }
+        if ((storage ? read_storage(buf, offset, keys_size) : read(buf, offset, keys_size)) != 0 ||
+            node->n == 0 || node->n > meta.order)
+            return 0;
+        off_t pos = offset + children_at + search_t::upper_bound(node->keys, node->n - 1, key) * sizeof(off_t);
+        if ((storage ? read_storage(&child, pos, sizeof(off_t)) : read(&child, pos, sizeof(off_t))) != 0)
+            return 0;
+        return child;
+    }
+    BPT_TEMPLATE
+    int BPT_CLASS::search_record(off_t offset, const key_t &key, value_t *value, bool storage) const
+    {
+        const size_t keys_size = SIZE_NO_CHILDREN + meta.order * sizeof(key_t);
+        const size_t values_at = leaf_node_t::values_at(meta.order);
+        const key_t *keys;
+        size_t n;
+        alignas(leaf_node_t) char buf[sizeof(leaf_node_t)];
+        if (mapped() && storage)
+        {
+            //不加锁时结点可能正被修改，只从映射中复制头部、比较的key和找到的value
+            if (offset + size_of((leaf_node_t *)NULL) > mapping.length.load(std::memory_order_acquire))
+                return -1;
+            mapping_t::load_words(buf, mapping.at(offset), SIZE_NO_CHILDREN);
+            n = ((const leaf_node_t *)buf)->n;
+            if (n > meta.order)
+                return -1;
+            size_t i = load_bound<false>(offset, n, key);
+            if (i == n)
+                return -1;
+            key_t found;
+            mapping_t::load_words(&found, mapping.at(key_at(offset, i)), sizeof(key_t));
+            mapping_t::load_words(value, mapping.at(offset + values_at + i * sizeof(value_t)), sizeof(value_t));
+            return keycmp(found, key);
+        }
+        bool direct = mapped() && !storage && pending.empty();
+        if (direct)
+        {
+            if (offset + size_of((leaf_node_t *)NULL) > mapping.length.load(std::memory_order_acquire))
+                return -1;
+            n = ((const leaf_node_t *)mapping.at(offset))->n;
+            keys = (const key_t *)(mapping.at(offset) + SIZE_NO_CHILDREN);
+        }
+        else
+        {
+            if ((storage ? read_storage(buf, offset, keys_size) : read(buf, offset, keys_size)) != 0)
+                return -1;
+            n = ((const leaf_node_t *)buf)->n;
+            keys = ((const leaf_node_t *)buf)->keys;
+        }
+        if (n > meta.order)
+            return -1;
+
+        size_t i = search_t::lower_bound(keys, n, key);
+        if (i == n)
+            //未找到该数据
+            return -1;
+        //找到了不小于key的数据，相等时才是该数据
+        int ret = keycmp(keys[i], key);
+        off_t pos = offset + values_at + i * sizeof(value_t);
+        if (direct)
+            memcpy(value, mapping.at(pos), sizeof(value_t));
+        else if ((storage ? read_storage(value, pos, sizeof(value_t)) : read(value, pos, sizeof(value_t))) != 0)
+            return -1;
+        return ret;
+    }
+    BPT_TEMPLATE
+    template <bool upper>
+    size_t BPT_CLASS::load_bound(off_t offset, size_t n, const key_t &key) const
+    {
+        //与int_search相同，二分查找缩小到BP_SEARCH_WINDOW个key以内再顺序比较，
+        //每次只从映射中复制比较的那个key。调用者已检查结点在映射范围内
+        const char *keys = mapping.at(key_at(offset, 0));
+        size_t base = 0;
+        key_t k;
+        while (n > BP_SEARCH_WINDOW)
+        {
+            size_t half = n / 2;
+            prefetch((const key_t *)keys + base, n, half);
+            mapping_t::load_words(&k, keys + (base + half) * sizeof(key_t), sizeof(key_t));
+            base = (upper ? keycmp(k, key) <= 0 : keycmp(k, key) < 0) ? base + half : base;
+            n -= half;
+        }
+        for (size_t end = base + n; base < end; base++)
+        {
+            mapping_t::load_words(&k, keys + base * sizeof(key_t), sizeof(key_t));
+            if (upper ? keycmp(k, key) > 0 : keycmp(k, key) >= 0)
+                break;
+        }
+        return base;
+    }
+    BPT_TEMPLATE
+    bool BPT_CLASS::snapshot(snapshot_t *s, off_t offset, size_t size) const
+    {
+        s->offset = offset;
+        s->size = size;
+        off_t first = offset / BP_PAGE_SIZE * BP_PAGE_SIZE;
+        for (off_t page = first; page < offset + (off_t)size; page += BP_PAGE_SIZE)
+        {
+            uint64_t v = versions[slot_of(page)].load(std::memory_order_acquire);
+            if (v & 1)
+                return false;
+            s->versions[(page - first) / BP_PAGE_SIZE] = v;
+        }
+        return true;
+    }
+    BPT_TEMPLATE
+    bool BPT_CLASS::validate(const snapshot_t &s) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        off_t first = s.offset / BP_PAGE_SIZE * BP_PAGE_SIZE;
+        for (off_t page = first; page < s.offset + (off_t)s.size; page += BP_PAGE_SIZE)
+            if (versions[slot_of(page)].load(std::memory_order_relaxed) !=
+                s.versions[(page - first) / BP_PAGE_SIZE])
+                return false;
+        return true;
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::unlock_pages()
+    {
+        if (txn_depth > 0)
+            return;
+        //先发布新的根结点，此时修改过的页面仍被锁住，读到旧根结点的查找会重试
+        if (root_offset.load(std::memory_order_relaxed) != meta.root_offset ||
+            root_height.load(std::memory_order_relaxed) != meta.height)
+        {
+            root_version.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            root_offset.store(meta.root_offset, std::memory_order_relaxed);
+            root_height.store(meta.height, std::memory_order_relaxed);
+            root_version.fetch_add(1, std::memory_order_release);
+        }
+        for (size_t i = 0; i < locked.size(); i++)
+            versions[locked[i]].fetch_add(1, std::memory_order_release);
+        locked.clear();
+    }
+
+    BPT_TEMPLATE
+    int BPT_CLASS::search_range(key_t *left, const key_t &right,
+                                value_t *values, size_t max, bool *next) const
+    {
+        if (buffer_size == 0)
+            return search_range_tree(left, right, values, max, next);
+        return search_range_buffered(left, right, values, max, next);
+    }
+    //从最小关键字起顺序查找，即从叶子结点出发查找。
+    BPT_TEMPLATE
+    int BPT_CLASS::search_range_tree(key_t *left, const key_t &right,
+                                     value_t *values, size_t max, bool *next) const
+    {
+        std::shared_lock<std::shared_mutex> lock(latch);
+        if (left == NULL || keycmp(*left, right) > 0)
+            return -1;
+        off_t off_left = search_leaf(*left);
+        off_t off_right = search_leaf(right);
+        off_t off = off_left;
+        size_t i = 0;
+        const_record_iterator b, e;
+
+        leaf_node_t buf;
+        const leaf_node_t *leaf;
+        readahead_t ra;
+        while (off != off_right && off != 0 && i < max)
+        {
+            leaf = peek(&buf, off);
+            if (leaf->next != off_right)
+                read_ahead(ra, leaf->next, true);
+
+            //刚开始
+            if (off_left == off)
+                b = find(*leaf, *left);
+            else
+                b = begin(*leaf);
+
+            e = end(*leaf);
+            for (; b != e && i < max; ++b, ++i)
+                values[i] = b->value;
+            off = leaf->next;
+        }
+
+        //最后一个叶子结点
+        if (i < max)
+        {
+            leaf = peek(&buf, off_right);
+
+            b = find(*leaf, *left);
+            e = upper_bound(begin(*leaf), end(*leaf), right);
+            for (; b != e && i < max; ++b, ++i)
+                values[i] = b->value;
+        }
+        //为下一次迭代做标记
+        if (next != NULL)
+        {
+            if (i == max && b != e)
+            {
+                *next = true;
+                *left = b->key;
+            }
+            else
+            {
+                *next = false;
+            }
+        }
+        return i;
+    }
+    BPT_TEMPLATE
+    template <class F>
+    size_t BPT_CLASS::search_range_parallel(const key_t &left, const key_t &right, F callback, size_t threads)
+    {
+        if (keycmp(left, right) > 0)
+            return 0;
+        if (buffer_size > 0)
+            drain();
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        //各线程在调用者持有的共享锁下扫描
+        std::shared_lock<std::shared_mutex> lock(latch);
+        std::vector<key_t> splits = split_range(left, right, threads);
+        size_t parts = splits.size() + 1;
+        std::vector<size_t> counts(parts);
+        parallel_for(parts, parts, [&](size_t b, size_t e)
+                     {
+                         for (size_t p = b; p < e; p++)
+                         {
+                             const key_t &from = p == 0 ? left : splits[p - 1];
+                             const key_t &to = p + 1 < parts ? splits[p] : right;
+                             counts[p] = scan_part(p, from, to, p + 1 == parts, callback);
+                         }
+                     });
+        size_t count = 0;
+        for (size_t p = 0; p < parts; p++)
+            count += counts[p];
+        return count;
+    }
+    BPT_TEMPLATE
+    std::vector<typename BPT_CLASS::key_t> BPT_CLASS::split_range(const key_t &left, const key_t &right,
+                                                                  size_t parts) const
+    {
+        //自上而下逐层展开与范围相交的内部结点，分隔key足够多或到达叶子结点的父结点时停止
+        std::vector<key_t> keys;
+        std::vector<off_t> nodes(1, meta.root_offset);
+        internal_node_t buf;
+        for (size_t depth = 0; depth < meta.height && parts > 1; depth++)
+        {
+            std::vector<off_t> children;
+            keys.clear();
+            for (size_t i = 0; i < nodes.size(); i++)
+            {
+                const internal_node_t *node = peek(&buf, nodes[i]);
+                //第j个孩子的key范围为[keys[j - 1], keys[j])
+                for (size_t j = 0; j < node->n; j++)
+                {
+                    bool after_left = j + 1 == node->n || keycmp(node->keys[j], left) > 0;
+                    bool before_right = j == 0 || keycmp(node->keys[j - 1], right) <= 0;
+                    if (after_left && before_right)
+                        children.push_back(node->children()[j]);
+                    if (j + 1 < node->n && keycmp(node->keys[j], left) > 0 && keycmp(node->keys[j], right) <= 0)
+                        keys.push_back(node->keys[j]);
+                }
+            }
+            if (keys.size() >= parts * BP_SCAN_SPLITS || depth + 1 == meta.height)
+                break;
+            nodes.swap(children);
+        }
+
+        //等距选出parts - 1个
+        std::vector<key_t> splits;
+        size_t k = std::min(parts - 1, keys.size());
+        for (size_t i = 1; i <= k; i++)
+            splits.push_back(keys[keys.size() * i / (k + 1)]);
+        return splits;
+    }
+    BPT_TEMPLATE
+    template <class F>
+    size_t BPT_CLASS::scan_part(size_t part, const key_t &from, const key_t &to, bool inclusive,
+                                F &callback) const
+    {
+        leaf_node_t buf;
+        readahead_t ra;
+        size_t count = 0;
+        off_t off = search_leaf(from);
+        bool first = true;
+        while (off != 0)
+        {
+            const leaf_node_t *leaf = peek(&buf, off);
+            const_record_iterator b = first ? find(*leaf, from) : begin(*leaf);
+            const_record_iterator e = inclusive ? upper_bound(begin(*leaf), end(*leaf), to)
+                                                : lower_bound(begin(*leaf), end(*leaf), to);
+            for (; b < e; ++b, ++count)
+                callback(part, b->key, b->value);
+            //这一段在当前叶子结点中结束
+            if (e != end(*leaf))
+                break;
+            off = leaf->next;
+            read_ahead(ra, off, true);
+            first = false;
+        }
+        return count;
+    }
+    //同时遍历两个跳表和B+树，同一个key以活动跳表、冻结跳表、B+树的顺序取最新的修改
+    BPT_TEMPLATE
+    int BPT_CLASS::search_range_buffered(key_t *left, const key_t &right,
+                                         value_t *values, size_t max, bool *next) const
+    {
+        if (left == NULL || keycmp(*left, right) > 0)
+            return -1;
+        typename buffer_t::guard_t guard(buffer);
+        typedef typename buffer_t::list_t list_t;
+        typedef typename buffer_t::entry_t entry_t;
+        const list_t *lists[2] = {buffer.active_list(), buffer.frozen_list()};
+        const entry_t *heads[2];
+        for (int l = 0; l < 2; l++)
+            heads[l] = lists[l] != NULL ? lists[l]->lower_bound(*left) : NULL;
+
+        //B+树中的数据项分批读出，被删除的key可能占去一部分，不够时再读
+        std::vector<record_t> records;
+        size_t pos = 0;
+        bool tree_done = false;
+        key_t from = *left;
+        bool skip_from = false;
+
+        size_t i = 0;
+        if (next != NULL)
+            *next = false;
+        while (true)
+        {
+            if (pos == records.size() && !tree_done)
+            {
+                size_t batch = std::max(max - i + 1, (size_t)BP_READAHEAD_MAX);
+                scan_tree(from, skip_from, right, batch, &records);
+                pos = 0;
+                tree_done = records.size() < batch;
+                if (!records.empty())
+                {
+                    from = records.back().key;
+                    skip_from = true;
+                }
+            }
+
+            //取三者中最小的key
+            const key_t *key = NULL;
+            for (int l = 0; l < 2; l++)
+                if (heads[l] != NULL && keycmp(heads[l]->key, right) <= 0 &&
+                    (key == NULL || keycmp(heads[l]->key, *key) < 0))
+                    key = &heads[l]->key;
+            if (pos < records.size() && (key == NULL || keycmp(records[pos].key, *key) < 0))
+                key = &records[pos].key;
+            if (key == NULL)
+                break;
+
+            key_t k = *key;
+            bool decided = false, found = false;
+            value_t value;
+            for (int l = 0; l < 2; l++)
+                if (heads[l] != NULL && keycmp(heads[l]->key, k) == 0)
+                {
+                    if (!decided)
+                    {
+                        decided = true;
+                        found = !heads[l]->removed;
+                        value = heads[l]->value;
+                    }
+                    heads[l] = lists[l]->next(heads[l]);
+                }
+            if (pos < records.size() && keycmp(records[pos].key, k) == 0)
+            {
+                if (!decided)
+                {
+                    found = true;
+                    value = records[pos].value;
+                }
+                ++pos;
+            }
+            if (!found)
+                continue;
+
+            //为下一次迭代做标记
+            if (i == max)
+            {
+                if (next != NULL)
+                {
+                    *next = true;
+                    *left = k;
+                }
+                break;
+            }
+            values[i++] = value;
+        }
+        return i;
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::scan_tree(const key_t &from, bool skip_from, const key_t &right, size_t max,
+                              std::vector<record_t> *records) const
+    {
+        std::shared_lock<std::shared_mutex> lock(latch);
+        records->clear();
+        off_t off = search_leaf(from);
+        bool first = true;
+        leaf_node_t buf;
+        readahead_t ra;
+        while (off != 0 && records->size() < max)
+        {
+            const leaf_node_t *leaf = peek(&buf, off);
+            if (leaf->next != 0)
+                read_ahead(ra, leaf->next, true);
+            const_record_iterator b = !first ? begin(*leaf)
+                                       : skip_from ? upper_bound(begin(*leaf), end(*leaf), from)
+                                                   : find(*leaf, from);
+            for (; b != end(*leaf) && records->size() < max; ++b)
+            {
+                if (keycmp(b->key, right) > 0)
+                    return;
+                records->push_back(*b);
+            }
+            first = false;
+            off = leaf->next;
+        }
+    }
+    //根据内部结点偏移量以及key值找到对应的叶子结点
+    BPT_TEMPLATE
+    off_t BPT_CLASS::search_leaf(off_t index, const key_t &key) const
+    {
+        return search_child(index, key);
+    }
+    //找到该key值对应的叶子结点的父结点
+    BPT_TEMPLATE
+    off_t BPT_CLASS::search_index(const key_t &key, path_t *path) const
+    {
+        off_t org = meta.root_offset;
+        int height = meta.height;
+        if (path != NULL)
+            path->clear();
+        while (true)
+        {
+            if (path != NULL)
+                path->push_back(org);
+            if (height == 1)
+                break;
+            org = search_child(org, key);
+            --height;
+        }
+        return org;
+    }
+    /*
+    *******
+    游标
+    *******
+    */
+    BPT_TEMPLATE
+    bool BPT_CLASS::cursor::load(off_t offset, bool forward)
+    {
+        while (offset != 0)
+        {
+            tree->read(&leaf, offset);
+            if (leaf.n > 0)
+                break;
+            offset = forward ? leaf.next : leaf.prev;
+        }
+        this->offset = offset;
+        if (offset != 0)
+            slot = forward ? 0 : leaf.n - 1;
+        return offset != 0;
+    }
+    BPT_TEMPLATE
+    bool BPT_CLASS::cursor::seek(const key_t &key)
+    {
+        std::shared_lock<std::shared_mutex> lock(tree->latch);
+        if (!load(tree->search_leaf(key), true))
+            return false;
+        const_record_iterator record = lower_bound(begin(leaf), end(leaf), key);
+        if (record == end(leaf))
+            return load(leaf.next, true);
+        slot = record - begin(leaf);
+        return true;
+    }
+    BPT_TEMPLATE
+    bool BPT_CLASS::cursor::seek_for_prev(const key_t &key)
+    {
+        std::shared_lock<std::shared_mutex> lock(tree->latch);
+        if (!load(tree->search_leaf(key), false))
+            return false;
+        const_record_iterator record = upper_bound(begin(leaf), end(leaf), key);
+        if (record == begin(leaf))
+            return load(leaf.prev, false);
+        slot = record - begin(leaf) - 1;
+        return true;
+    }
+    BPT_TEMPLATE
+    bool BPT_CLASS::cursor::seek_first()
+    {
+        std::shared_lock<std::shared_mutex> lock(tree->latch);
+        return load(tree->meta.leaf_offset, true);
+    }
+    BPT_TEMPLATE
+    bool BPT_CLASS::cursor::seek_last()
+    {
+        std::shared_lock<std::shared_mutex> lock(tree->latch);
+        //沿每层最右边的孩子找到最后一个叶子结点
+        off_t org = tree->meta.root_offset;
+        internal_node_t buf;
+        for (size_t height = tree->meta.height; height > 0; --height)
+        {
+            const internal_node_t *node = tree->peek(&buf, org);
+            org = (end(*node) - 1)->child;
+        }
+        return load(org, false);
+    }
+    BPT_TEMPLATE
+    bool BPT_CLASS::cursor::next()
+    {
+        if (offset == 0)
+            return false;
+        if (++slot < leaf.n)
+            return true;
+        std::shared_lock<std::shared_mutex> lock(tree->latch);
+        key_t last = leaf.keys[leaf.n - 1];
+        tree->read_ahead(ra, leaf.next, true);
+        if (!load(leaf.next, true))
+            return false;
+        if (leaf.n <= tree->meta.order && keycmp(leaf.keys[slot], last) > 0)
+            return true;
+        return relocate(last, true);
+    }
+    BPT_TEMPLATE
+    bool BPT_CLASS::cursor::prev()
+    {
+        if (offset == 0)
+            return false;
+        if (slot > 0)
+        {
+            --slot;
+            return true;
+        }
+        std::shared_lock<std::shared_mutex> lock(tree->latch);
+        key_t first = leaf.keys[0];
+        tree->read_ahead(ra, leaf.prev, false);
+        if (!load(leaf.prev, false))
+            return false;
+        if (leaf.n <= tree->meta.order && keycmp(leaf.keys[slot], first) < 0)
+            return true;
+        return relocate(first, false);
+    }
+    BPT_TEMPLATE
+    bool BPT_CLASS::cursor::relocate(const key_t &key, bool forward)
+    {
+        if (!load(tree->search_leaf(key), forward))
+            return false;
+        if (forward)
+        {
+            const_record_iterator record = upper_bound(begin(leaf), end(leaf), key);
+            if (record == end(leaf))
+                return load(leaf.next, true);
+            slot = record - begin(leaf);
+        }
+        else
+        {
+            const_record_iterator record = lower_bound(begin(leaf), end(leaf), key);
+            if (record == begin(leaf))
+                return load(leaf.prev, false);
+            slot = record - begin(leaf) - 1;
+        }
+        return true;
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::read_ahead(readahead_t &ra, off_t next, bool forward) const
+    {
+        if (next == 0)
+            return;
+        off_t size = size_of((leaf_node_t *)NULL);
+        if (next != ra.expect)
+        {
+            //不连续的结点无法预知后续位置
+            ra.expect = forward ? next + size : next - size;
+            ra.edge = 0;
+            ra.depth = 0;
+            return;
+        }
+        ra.expect = forward ? next + size : next - size;
+        ra.depth = std::min(std::max(ra.depth * 2, (size_t)BP_READAHEAD_MIN), (size_t)BP_READAHEAD_MAX);
+
+        //已预读的部分还剩一半以上时不再提示
+        off_t window = ra.depth * size;
+        if (forward)
+        {
+            if (ra.edge > next && ra.edge - next >= window / 2)
+                return;
+            off_t from = std::max(ra.edge, next);
+            ra.edge = next + window;
+            advise(from, ra.edge - from);
+        }
+        else
+        {
+            if (ra.edge != 0 && ra.edge <= next && next - ra.edge >= window / 2)
+                return;
+            off_t to = ra.edge != 0 && ra.edge <= next ? ra.edge : next + size;
+            ra.edge = std::max(next + size - window, (off_t)(OFFSET_BLOCK));
+            if (to > ra.edge)
+                advise(ra.edge, to - ra.edge);
+        }
+    }
+    BPT_TEMPLATE
+    int BPT_CLASS::search_batch(const key_t *keys, size_t n, value_t *values, int *status) const
+    {
+        if (buffer_size == 0)
+            return search_batch_tree(keys, n, values, status);
+
+        //写缓冲中有结果的key不再查找B+树，其余的key一起批量查找
+        typename buffer_t::guard_t guard(buffer);
+        int found = 0;
+        std::vector<size_t> rest;
+        for (size_t i = 0; i < n; i++)
+        {
+            int state = buffer.get(keys[i], &values[i]);
+            if (state < 0)
+                rest.push_back(i);
+            else if ((status[i] = state == 0 ? 0 : -1) == 0)
+                ++found;
+        }
+        if (rest.empty())
+            return found;
+        std::vector<key_t> rest_keys(rest.size());
+        std::vector<value_t> rest_values(rest.size());
+        std::vector<int> rest_status(rest.size());
+        for (size_t i = 0; i < rest.size(); i++)
+            rest_keys[i] = keys[rest[i]];
+        found += search_batch_tree(rest_keys.data(), rest.size(), rest_values.data(), rest_status.data());
+        for (size_t i = 0; i < rest.size(); i++)
+        {
+            status[rest[i]] = rest_status[i];
+            if (rest_status[i] == 0)
+                values[rest[i]] = rest_values[i];
+        }
+        return found;
+    }
+    BPT_TEMPLATE
+    int BPT_CLASS::search_batch_tree(const key_t *keys, size_t n, value_t *values, int *status) const
+    {
+        std::shared_lock<std::shared_mutex> lock(latch);
+        std::vector<size_t> probes(n);
+        for (size_t i = 0; i < n; i++)
+            probes[i] = i;
+        probe_less less = {keys};
+        std::sort(probes.begin(), probes.end(), less);
+
+        //path[d]为当前路径上第d层的内部结点及其key值上界
+        struct level_t
+        {
+            const internal_node_t *node;
+            key_t fence;
+            bool bounded;
+        };
+        std::vector<level_t> path;
+        std::vector<internal_node_t> bufs(meta.height);
+        leaf_node_t buf;
+        const leaf_node_t *leaf = NULL;
+        key_t fence;
+        bool bounded = false;
+
+        int found = 0;
+        for (size_t p = 0; p < n; p++)
+        {
+            const key_t &key = keys[probes[p]];
+            if (leaf == NULL || (bounded && keycmp(key, fence) >= 0))
+            {
+                //回退到仍然包含key的最低一层，再从那里向下查找
+                while (!path.empty() && path.back().bounded && keycmp(key, path.back().fence) >= 0)
+                    path.pop_back();
+                if (path.empty())
+                {
+                    level_t root = {peek(&bufs[0], meta.root_offset), key_t(), false};
+                    path.push_back(root);
+                }
+                while (true)
+                {
+                    const level_t &level = path.back();
+                    const_index_iterator i = upper_bound(begin(*level.node), end(*level.node) - 1, key);
+                    bounded = i != end(*level.node) - 1 || level.bounded;
+                    fence = i != end(*level.node) - 1 ? i->key : level.fence;
+                    if (path.size() == meta.height)
+                    {
+                        leaf = peek(&buf, i->child);
+                        break;
+                    }
+                    level_t child = {peek(&bufs[path.size()], i->child), fence, bounded};
+                    path.push_back(child);
+                }
+            }
+
+            const_record_iterator record = find(*leaf, key);
+            status[probes[p]] = record != end(*leaf) && keycmp(record->key, key) == 0 ? 0 : -1;
+            if (status[probes[p]] == 0)
+            {
+                values[probes[p]] = record->value;
+                ++found;
+            }
+        }
+        return found;
+    }
+    BPT_TEMPLATE
+    off_t BPT_CLASS::search_leaf(const key_t &key, key_t *fence, bool *bounded) const
+    {
+        off_t org = meta.root_offset;
+        int height = meta.height;
+        internal_node_t buf;
+        *bounded = false;
+        while (true)
+        {
+            const internal_node_t *node = peek(&buf, org);
+
+            const_index_iterator i = upper_bound(begin(*node), end(*node) - 1, key);
+            //越往下的分隔key越接近叶子结点的范围
+            if (i != end(*node) - 1)
+            {
+                *fence = i->key;
+                *bounded = true;
+            }
+            if (height == 1)
+                return i->child;
+            org = i->child;
+            --height;
+        }
+    }
+    /*
+    *******
+    删除相关
+    *******
+    */
+    BPT_TEMPLATE
+    int BPT_CLASS::remove(const key_t &key)
+    {
+        if (key_too_long(key))
+            return -1;
+        if (buffer_size > 0)
+            return write_buffered(BUFFER_REMOVE, key, value_t());
+        txn_t txn(this);
+        return remove_key(key);
+    }
+    BPT_TEMPLATE
+    int BPT_CLASS::remove_key(const key_t &key)
+    {
+        node_arena::scope_t scope(frames);
+        leaf_node_t &leaf = frame<leaf_node_t>();
+
+        //找到父结点，同时记下从根结点下来的路径
+        path_t path;
+        off_t parent_off = search_index(key, &path);
+
+        //找到当前结点
+        off_t offset = search_leaf(parent_off, key);
+        const leaf_node_t *node = view(&leaf, offset);
+
+        //核实当前结点的正确性，key不存在时不复制结点
+        if (!binary_search(begin(*node), end(*node), key))
+            return -1;
+        materialize(&leaf, node, offset);
+
+        size_t min_n = meta.leaf_node_num == 1 ? 0 : meta.order / 2;
+        assert(leaf.n >= min_n && leaf.n <= meta.order);
+
+        //删除该key值
+        record_iterator to_delete = find(leaf, key);
+        size_t slot = to_delete - begin(leaf);
+        value_t removed = to_delete->value;
+        std::copy(to_delete + 1, end(leaf), to_delete);
+        //std::copy(要拷贝元素的首地址，要拷贝元素的最后一个地址的下一个地址，要拷贝的目的地的首地址)
+        leaf.n--;
+
+        //合并或者借用其他结点的key值
+        if (leaf.n < min_n)
+        {
+            //先尝试从左兄弟结点借
+            bool borrowed = false;
+            if (leaf.prev != 0)
+                borrowed = borrow_key(false, leaf);
+
+            //再尝试从右兄弟借
+            if (!borrowed && leaf.next != 0)
+                borrowed = borrow_key(true, leaf);
+
+            //若都无法借，则尝试合并
+            if (!borrowed)
+            {
+                assert(leaf.next != 0 || leaf.prev != 0);
+                internal_node_t &parent = frame<internal_node_t>();
+                fetch(&parent, parent_off);
+                index_iterator where = find(parent, key);
+                key_t index_key;
+                if (where == end(parent) - 1)
+                {
+                    //若该结点为父结点最右边的子结点，则合并prev和leaf
+                    assert(leaf.prev != 0);
+                    leaf_node_t &prev = frame<leaf_node_t>();
+                    fetch(&prev, leaf.prev);
+                    index_key = begin(prev)->key;
+
+                    merge_leafs(&prev, &leaf);
+                    node_remove(&prev, &leaf);
+                    write(&prev, leaf.prev);
+                    mark_stale(prev, leaf.prev);
+                }
+                else
+                {
+                    //否则合并leaf和next
+                    assert(leaf.next != 0);
+                    leaf_node_t &next = frame<leaf_node_t>();
+                    fetch(&next, leaf.next);
+                    //用被删除的key定位leaf在父结点中的索引项
+                    index_key = key;
+
+                    merge_leafs(&leaf, &next);
+                    node_remove(&leaf, &next);
+                    write(&leaf, offset);
+                    mark_stale(leaf, offset);
+                }
+                //删除父结点对应的key
+                remove_from_index(path, parent, index_key);
+            }
+            else
+            {
+                write(&leaf, offset);
+                mark_stale(leaf, offset);
+            }
+        }
+        else
+        {
+            //只有被删除的数据项之后的部分前移
+            write_entries(&leaf, offset, slot, leaf.n);
+            adjust_aggregates(path, key, &removed, NULL);
+        }
+        return 0;
+    }
+    //叶子结点的借操作
+    BPT_TEMPLATE
+    bool BPT_CLASS::borrow_key(bool from_right, leaf_node_t &borrower)
+    {
+        off_t lender_off = from_right ? borrower.next : borrower.prev;
+        node_arena::scope_t scope(frames);
+        leaf_node_t &lender = frame<leaf_node_t>();
+        //借不到时只读取兄弟结点，不复制
+        const leaf_node_t *node = view(&lender, lender_off);
+
+        assert(node->n >= meta.order / 2);
+        if (node->n != meta.order / 2)
+        {
+            materialize(&lender, node, lender_off);
+            typename leaf_node_t::child_t where_to_lend, where_to_put;
+            if (from_right)
+            {
+                where_to_lend = begin(lender);
+                where_to_put = end(borrower);
+                change_parent_child(begin(borrower)->key, lender.keys[1]);
+            }
+            else
+            {
+                where_to_lend = end(lender) - 1;
+                where_to_put = begin(borrower);
+                change_parent_child(begin(lender)->key, where_to_lend->key);
+            }
+            //更新borrower结点
+            std::copy_backward(where_to_put, end(borrower), end(borrower) + 1);
+            *where_to_put = *where_to_lend;
+            borrower.n++;
+
+            //更新lender结点
+            std::copy(where_to_lend + 1, end(lender), where_to_lend);
+            lender.n--;
+            write(&lender, lender_off);
+            mark_stale(lender, lender_off);
+            return true;
+        }
+        return false;
+    }
+    //更新o所在结点右边的分隔key，将o改为n。结点是父结点的最后一个孩子时
+    //分隔key在更上层，沿查找o的路径自下而上修改
+    BPT_TEMPLATE
+    void BPT_CLASS::change_parent_child(const key_t &o, const key_t &n)
+    {
+        path_t path;
+        search_index(o, &path);
+        node_arena::scope_t scope(frames);
+        internal_node_t &buf = frame<internal_node_t>();
+        while (!path.empty())
+        {
+            off_t offset = path.back();
+            path.pop_back();
+            const internal_node_t *node = view(&buf, offset);
+
+            const_index_iterator w = find(*node, o);
+            assert(w != end(*node));
+            size_t i = w - begin(*node);
+            bool last = w == end(*node) - 1;
+
+            //只写回被修改的key
+            write(&n, key_at(offset, i), sizeof(key_t));
+            if (!last)
+                break;
+        }
+    }
+    //合并两个叶子结点
+    BPT_TEMPLATE
+    void BPT_CLASS::merge_leafs(leaf_node_t *left, leaf_node_t *right)
+    {
+        std::copy(begin(*right), end(*right), end(*left));
+        left->n += right->n;
+    }
+    //删除一个结点
+    BPT_TEMPLATE
+    template <class T>
+    void BPT_CLASS::node_remove(T *prev, T *node)
+    {
+        unalloc(node, prev->next);
+        prev->next = node->next;
+        if (node->next != 0)
+        {
+            node_arena::scope_t scope(frames);
+            T &next = frame<T>();
+            fetch(&next, node->next, SIZE_NO_CHILDREN);
+            next.prev = node->prev;
+            write(&next, node->next, SIZE_NO_CHILDREN);
+        }
+        write(&meta, OFFSET_META);
+    }
+    //删除一个内部节点
+    BPT_TEMPLATE
+    void BPT_CLASS::remove_from_index(path_t &path, internal_node_t &node,
+                                const key_t &key)
+    {
+        off_t offset = path.back();
+        path.pop_back();
+        size_t level = meta.height - path.size();
+        size_t min_n = meta.root_offset == offset ? 1 : meta.order / 2;
+        assert(node.n >= min_n && node.n <= meta.order);
+
+        //删除key
+        key_t index_key = begin(node)->key;
+        index_iterator to_delete = find(node, key);
+        if (to_delete < end(node) - 1)
+        {
+            (to_delete + 1)->child = to_delete->child;
+            std::copy(to_delete + 1, end(node), to_delete);
+        }
+        node.n--;
+        //当被删除的是父结点最后一个key时
+        if (node.n == 1 && meta.root_offset == offset &&
+            meta.internal_node_num != 1)
+        {
+            unalloc(&node, meta.root_offset);
+            meta.height--;
+            meta.root_offset = node.children()[0];
+            write(&meta, OFFSET_META);
+            return;
+        }
+        //合并或者借兄弟结点的key
+        if (node.n < min_n)
+        {
+            //不是根结点，路径上还有父结点
+            off_t parent_off = path.back();
+            node_arena::scope_t scope(frames);
+            internal_node_t &parent = frame<internal_node_t>();
+            fetch(&parent, parent_off);
+
+            //先从左边借
+            bool borrowed = false;
+            if (offset != begin(parent)->child)
+                borrowed = borrow_key(false, node, offset, parent_off, level);
+
+            //再从右边借
+            if (!borrowed && offset != (end(parent) - 1)->child)
+            {
+                borrowed = borrow_key(true, node, offset, parent_off, level);
+            }
+            //都不成功，则合并
+            if (!borrowed)
+            {
+                assert(node.next != 0 || node.prev != 0);
+                if (offset == (end(parent) - 1)->child)
+                {
+                    //若该结点为父结点的最右边结点，则合并prev和node
+                    assert(node.prev != 0);
+                    internal_node_t &prev = frame<internal_node_t>();
+                    fetch(&prev, node.prev);
+
+                    //合并
+                    index_iterator where = find(parent, begin(prev)->key);
+                    merge_keys(where, prev, node);
+                    write(&prev, node.prev);
+                    mark_stale(prev, node.prev, level);
+                }
+                else
+                {
+                    //否则合并next和node
+                    assert(node.next != 0);
+                    internal_node_t &next = frame<internal_node_t>();
+                    fetch(&next, node.next);
+
+                    index_iterator where = find(parent, index_key);
+                    merge_keys(where, node, next);
+                    write(&node, offset);
+                    mark_stale(node, offset, level);
+                }
+                //删除父结点的key
+                remove_from_index(path, parent, index_key);
+            }
+            else
+            {
+                write(&node, offset);
+                mark_stale(node, offset, level);
+            }
+        }
+        else
+        {
+            write(&node, offset);
+            mark_stale(node, offset, level);
+        }
+    }
+    //内部结点的借操作
+    BPT_TEMPLATE
+    bool BPT_CLASS::borrow_key(bool from_right, internal_node_t &borrower,
+                         off_t offset, off_t parent_off, size_t level)
+    {
+        typedef typename internal_node_t::child_t child_t;
+
+        off_t lender_off = from_right ? borrower.next : borrower.prev;
+        node_arena::scope_t scope(frames);
+        internal_node_t &lender = frame<internal_node_t>();
+        const internal_node_t *node = view(&lender, lender_off);
+
+        assert(node->n >= meta.order / 2);
+        if (node->n != meta.order / 2)
+        {
+            materialize(&lender, node, lender_off);
+            child_t where_to_lend, where_to_put;
+            internal_node_t &parent = frame<internal_node_t>();
+            fetch(&parent, parent_off);
+
+            //从右兄弟结点中借多余的key值，父结点中的分隔key下移，lender的第一个key上移。
+            if (from_right)
+            {
+                where_to_lend = begin(lender);
+                where_to_put = end(borrower);
+
+                child_t where = find_child(parent, offset);
+                (end(borrower) - 1)->key = where->key;
+                where->key = where_to_lend->key;
+            }
+            //从左兄弟结点中借多余的key值，父结点中的分隔key下移，lender的最后一个key上移。
+            else
+            {
+                where_to_lend = end(lender) - 1;
+                where_to_put = begin(borrower);
+
+                child_t where = find_child(parent, lender_off);
+                where_to_lend->key = where->key;
+                where->key = (where_to_lend - 1)->key;
+            }
+            write(&parent, parent_off);
+            //更新borroer结点
+            std::copy_backward(where_to_put, end(borrower), end(borrower) + 1);
+            //std::copy_backward(要拷贝元素的首地址，要拷贝元素的最后一个地址的下一个地址，要拷贝目的地的尾地址的下一个地址)
+            *where_to_put = *where_to_lend;
+            borrower.n++;
+
+            //更新lender结点
+            std::copy(where_to_lend + 1, end(lender), where_to_lend);
+            lender.n--;
+            write(&lender, lender_off);
+            mark_stale(lender, lender_off, level);
+            return true;
+        }
+        return false;
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::merge_keys(index_iterator where,
+                         internal_node_t &node, internal_node_t &next)
+    {
+        //父结点中的分隔key下移至node的最后一个索引项
+        (end(node) - 1)->key = where->key;
+        std::copy(begin(next), end(next), end(node));
+        node.n += next.n;
+        node_remove(&node, &next);
+    }
+    /*
+    *******
+    增加相关
+    *******
+    */
+    BPT_TEMPLATE
+    int BPT_CLASS::insert(const key_t &key, value_t value)
+    {
+        if (key_too_long(key))
+            return -1;
+        if (buffer_size > 0)
+            return write_buffered(BUFFER_INSERT, key, value);
+        txn_t txn(this);
+        path_t path;
+        off_t parent = search_index(key, &path);
+        off_t offset = search_leaf(parent, key);
+        node_arena::scope_t scope(frames);
+        leaf_node_t &leaf = frame<leaf_node_t>();
+        const leaf_node_t *node = view(&leaf, offset);
+
+        //检查是否已有相同key值，已存在时不复制结点
+        if (binary_search(begin(*node), end(*node), key))
+            return 1;
+        materialize(&leaf, node, offset);
+
+        if (leaf.n == meta.order)
+        {
+            //当数据项数满时，进行分裂
+            leaf_node_t &new_leaf = frame<leaf_node_t>();
+            node_create(offset, &leaf, &new_leaf);
+
+            //找到合适的分裂点
+            size_t point = leaf.n / 2;
+            bool place_right = keycmp(key, leaf.keys[point]) > 0;
+            if (place_right)
+                ++point;
+
+            //分裂
+            std::copy(begin(leaf) + point, end(leaf), begin(new_leaf));
+            new_leaf.n = leaf.n - point;
+            leaf.n = point;
+
+            //将key分配至分裂出的结点
+            if (place_right)
+                insert_record_no_split(&new_leaf, key, value);
+            else
+                insert_record_no_split(&leaf, key, value);
+
+            //保存叶子结点
+            write(&leaf, offset);
+            write(&new_leaf, leaf.next);
+            mark_stale(leaf, offset);
+            mark_stale(new_leaf, leaf.next);
+
+            //在父结点中添加索引项
+            insert_key_to_index(path, new_leaf.keys[0],
+                                offset, leaf.next);
+        }
+        else
+        {
+            //新数据项之前的部分没有改变
+            size_t slot = insert_record_no_split(&leaf, key, value);
+            write_entries(&leaf, offset, slot, leaf.n);
+            adjust_aggregates(path, key, NULL, &value);
+        }
+        return 0;
+    }
+    //创建一个新结点
+    BPT_TEMPLATE
+    template <class T>
+    void BPT_CLASS::node_create(off_t offset, T *node, T *next)
+    {
+        next->next = node->next;
+        next->prev = offset;
+        node->next = alloc(next);
+        //更新node->next->next结点的prev
+        if (next->next != 0)
+        {
+            node_arena::scope_t scope(frames);
+            T &old_next = frame<T>();
+            fetch(&old_next, next->next, SIZE_NO_CHILDREN);
+            old_next.prev = node->next;
+            write(&old_next, next->next, SIZE_NO_CHILDREN);
+        }
+        write(&meta, OFFSET_META);
+    }
+    //在叶子结点中添加新的数据项(无分裂)
+    BPT_TEMPLATE
+    size_t BPT_CLASS::insert_record_no_split(leaf_node_t *leaf,
+                                       const key_t &key, const value_t &value)
+    {
+        record_iterator where = upper_bound(begin(*leaf), end(*leaf), key);
+        std::copy_backward(where, end(*leaf), end(*leaf) + 1);
+
+        where->key = key;
+        where->value = value;
+        leaf->n++;
+        return where - begin(*leaf);
+    }
+    //在内部结点中添加新的索引项
+    BPT_TEMPLATE
+    void BPT_CLASS::insert_key_to_index(path_t &path, const key_t &key,
+                                  off_t old, off_t after)
+    {
+        if (path.empty())
+        {
+            //创建新的根结点
+            node_arena::scope_t scope(frames);
+            internal_node_t &root = frame<internal_node_t>();
+            root.next = root.prev = 0;
+            meta.root_offset = alloc(&root);
+            meta.height++;
+
+            //添加"old"和"after"
+            root.n = 2;
+            root.keys[0] = key;
+            root.children()[0] = old;
+            root.children()[1] = after;
+            //两个孩子结点都已记下，汇总值在修改操作结束时算出
+            root.aggs()[0] = root.aggs()[1] = aggregate_t();
+
+            write(&meta, OFFSET_META);
+            write(&root, meta.root_offset);
+            return;
+        }
+        off_t offset = path.back();
+        path.pop_back();
+        size_t level = meta.height - path.size();
+        node_arena::scope_t scope(frames);
+        internal_node_t &node = frame<internal_node_t>();
+        fetch(&node, offset);
+        assert(node.n <= meta.order);
+
+        if (node.n == meta.order)
+        {
+            //当数据项满时进行分裂
+
+            internal_node_t &new_node = frame<internal_node_t>();
+            node_create(offset, &node, &new_node);
+
+            //找到合适的分裂点
+            size_t point = (node.n - 1) / 2;
+            bool place_right = keycmp(key, node.keys[point]) > 0;
+            if (place_right)
+                ++point;
+            //prevent the 'key' being the right 'middle_key'
+            if (place_right && keycmp(key, node.keys[point]) < 0)
+                point--;
+
+            key_t middle_key = node.keys[point];
+
+            //分裂
+            std::copy(begin(node) + point + 1, end(node), begin(new_node));
+            new_node.n = node.n - point - 1;
+            node.n = point + 1;
+
+            //放置新key
+            if (place_right)
+                insert_key_to_index_no_split(new_node, key, after);
+            else
+                insert_key_to_index_no_split(node, key, after);
+            write(&node, offset);
+            write(&new_node, node.next);
+            mark_stale(node, offset, level);
+            mark_stale(new_node, node.next, level);
+
+            //give the middle key to the parent
+            //note:middle key's child is reserved
+            insert_key_to_index(path, middle_key, offset, node.next);
+        }
+        else
+        {
+            size_t slot = insert_key_to_index_no_split(node, key, after);
+            write_entries(&node, offset, slot, node.n);
+            mark_stale(node, offset, level);
+        }
+    }
+    BPT_TEMPLATE
+    size_t BPT_CLASS::insert_key_to_index_no_split(internal_node_t &node,
+                                             const key_t &key, off_t value)
+    {
+        index_iterator where = upper_bound(begin(node), end(node) - 1, key);
+
+        //将索引项整体后移
+        std::copy_backward(where, end(node), end(node) + 1);
+
+        //插入该key
+        where->key = key;
+        where->child = (where + 1)->child;
+        (where + 1)->child = value;
+        //*******
+        node.n++;
+        return where - begin(node);
+    }
+    /*
+    *******
+    更新相关
+    *******
+    */
+    BPT_TEMPLATE
+    int BPT_CLASS::update(const key_t &key, value_t value)
+    {
+        if (key_too_long(key))
+            return -1;
+        if (buffer_size > 0)
+            return write_buffered(BUFFER_UPDATE, key, value);
+        txn_t txn(this);
+        path_t path;
+        off_t offset = search_leaf(search_index(key, &path), key);
+        node_arena::scope_t scope(frames);
+        leaf_node_t &buf = frame<leaf_node_t>();
+        const leaf_node_t *leaf = view(&buf, offset);
+
+        const_record_iterator record = find(*leaf, key);
+        if (record != end(*leaf))
+            if (keycmp(key, record->key) == 0)
+            {
+                //只写回被修改的value
+                value_t old = record->value;
+                write(&value, payload_at(leaf, offset, record - begin(*leaf)), sizeof(value_t));
+                adjust_aggregates(path, key, &old, &value);
+
+                return 0;
+            }
+            else
+            {
+                return 1;
+            }
+        else
+            return -1;
+    }
+    /*
+    *******
+    汇总值
+    *******
+    */
+    BPT_TEMPLATE
+    typename BPT_CLASS::aggregate_t BPT_CLASS::aggregate(const key_t &left, const key_t &right)
+    {
+        drain();
+        std::shared_lock<std::shared_mutex> lock(latch);
+        aggregate_t result = aggregate_t();
+        if (keycmp(left, right) > 0)
+            return result;
+        if (!aggregated())
+            return aggregate_scan(left, right);
+
+        //两个边界落在同一个孩子结点时向下一层；分开之后，两者之间的孩子结点直接使用汇总值，
+        //两侧的孩子结点各自沿边界向下
+        internal_node_t buf;
+        off_t org = meta.root_offset;
+        for (size_t height = meta.height; height > 0; height--)
+        {
+            const internal_node_t *node = peek(&buf, org);
+            size_t i = find(*node, left) - begin(*node);
+            size_t j = find(*node, right) - begin(*node);
+            if (i != j)
+            {
+                for (size_t k = i + 1; k < j; k++)
+                    result.merge(node->aggs()[k]);
+                off_t l = node->children()[i], r = node->children()[j];
+                aggregate_edge(l, height - 1, left, false, &result);
+                aggregate_edge(r, height - 1, right, true, &result);
+                return result;
+            }
+            org = node->children()[i];
+        }
+        leaf_node_t leaf_buf;
+        const leaf_node_t *leaf = peek(&leaf_buf, org);
+        for (const_record_iterator r = find(*leaf, left); r != end(*leaf) && keycmp(r->key, right) <= 0; ++r)
+            result.add(r->value);
+        return result;
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::aggregate_edge(off_t offset, size_t height, const key_t &bound, bool upper,
+                                   aggregate_t *result) const
+    {
+        internal_node_t buf;
+        for (; height > 0; height--)
+        {
+            const internal_node_t *node = peek(&buf, offset);
+            size_t i = find(*node, bound) - begin(*node);
+            //upper为真时取bound左侧的孩子结点，否则取右侧的
+            for (size_t k = upper ? 0 : i + 1; k < (upper ? i : node->n); k++)
+                result->merge(node->aggs()[k]);
+            offset = node->children()[i];
+        }
+        leaf_node_t leaf_buf;
+        const leaf_node_t *leaf = peek(&leaf_buf, offset);
+        const_record_iterator b = upper ? begin(*leaf) : find(*leaf, bound);
+        const_record_iterator e = upper ? upper_bound(begin(*leaf), end(*leaf), bound) : end(*leaf);
+        for (; b < e; ++b)
+            result->add(b->value);
+    }
+    BPT_TEMPLATE
+    typename BPT_CLASS::aggregate_t BPT_CLASS::aggregate_scan(const key_t &left, const key_t &right) const
+    {
+        aggregate_t result = aggregate_t();
+        leaf_node_t buf;
+        readahead_t ra;
+        off_t off = search_leaf(left);
+        bool first = true;
+        while (off != 0)
+        {
+            const leaf_node_t *leaf = peek(&buf, off);
+            const_record_iterator b = first ? find(*leaf, left) : begin(*leaf);
+            const_record_iterator e = upper_bound(begin(*leaf), end(*leaf), right);
+            for (; b < e; ++b)
+                result.add(b->value);
+            if (e != end(*leaf))
+                break;
+            off = leaf->next;
+            read_ahead(ra, off, true);
+            first = false;
+        }
+        return result;
+    }
+    BPT_TEMPLATE
+    size_t BPT_CLASS::rank(const key_t &key)
+    {
+        drain();
+        std::shared_lock<std::shared_mutex> lock(latch);
+        size_t count = 0;
+        leaf_node_t leaf_buf;
+        if (!aggregated())
+        {
+            //沿叶子结点链表数到key所在的叶子结点
+            for (off_t off = meta.leaf_offset; off != 0;)
+            {
+                const leaf_node_t *leaf = peek(&leaf_buf, off);
+                size_t i = find(*leaf, key) - begin(*leaf);
+                count += i;
+                if (i < leaf->n)
+                    break;
+                off = leaf->next;
+            }
+            return count;
+        }
+
+        //key左侧的孩子结点中的key都小于key
+        internal_node_t buf;
+        off_t org = meta.root_offset;
+        for (size_t height = meta.height; height > 0; height--)
+        {
+            const internal_node_t *node = peek(&buf, org);
+            size_t i = find(*node, key) - begin(*node);
+            for (size_t k = 0; k < i; k++)
+                count += node->aggs()[k].count;
+            org = node->children()[i];
+        }
+        const leaf_node_t *leaf = peek(&leaf_buf, org);
+        return count + (find(*leaf, key) - begin(*leaf));
+    }
+    BPT_TEMPLATE
+    int BPT_CLASS::select(size_t k, key_t *key, value_t *value)
+    {
+        drain();
+        std::shared_lock<std::shared_mutex> lock(latch);
+        leaf_node_t leaf_buf;
+        off_t org = meta.leaf_offset;
+        if (aggregated())
+        {
+            //跳过个数之和不超过k的孩子结点
+            internal_node_t buf;
+            org = meta.root_offset;
+            for (size_t height = meta.height; height > 0; height--)
+            {
+                const internal_node_t *node = peek(&buf, org);
+                size_t i = 0;
+                for (; i + 1 < node->n && k >= node->aggs()[i].count; i++)
+                    k -= node->aggs()[i].count;
+                org = node->children()[i];
+            }
+        }
+        //不保存汇总值时从第一个叶子结点开始逐个跳过
+        while (org != 0)
+        {
+            const leaf_node_t *leaf = peek(&leaf_buf, org);
+            if (k < leaf->n)
+            {
+                *key = leaf->keys[k];
+                *value = leaf->values()[k];
+                return 0;
+            }
+            if (aggregated())
+                break;
+            k -= leaf->n;
+            org = leaf->next;
+        }
+        return -1;
+    }
+    BPT_TEMPLATE
+    typename BPT_CLASS::aggregate_t BPT_CLASS::aggregate_of(const leaf_node_t &leaf)
+    {
+        aggregate_t agg = aggregate_t();
+        for (size_t i = 0; i < leaf.n; i++)
+            agg.add(leaf.values()[i]);
+        return agg;
+    }
+    BPT_TEMPLATE
+    typename BPT_CLASS::aggregate_t BPT_CLASS::aggregate_of(const internal_node_t &node)
+    {
+        aggregate_t agg = aggregate_t();
+        for (size_t i = 0; i < node.n; i++)
+            agg.merge(node.aggs()[i]);
+        return agg;
+    }
+    BPT_TEMPLATE
+    size_t BPT_CLASS::search_slot(off_t offset, const key_t &key) const
+    {
+        if (mapped() && pending.empty())
+        {
+            const internal_node_t *node = (const internal_node_t *)mapping.at(offset);
+            return search_t::upper_bound(node->keys, node->n - 1, key);
+        }
+        node_arena::scope_t scope(frames);
+        internal_node_t &node = frame<internal_node_t>();
+        fetch(&node, offset, SIZE_NO_CHILDREN + meta.order * sizeof(key_t));
+        return search_t::upper_bound(node.keys, node.n - 1, key);
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::adjust_aggregates(const path_t &path, const key_t &key,
+                                      const value_t *removed, const value_t *added)
+    {
+        if (!aggregated())
+            return;
+        node_arena::scope_t scope(frames);
+        leaf_node_t &leaf = frame<leaf_node_t>();
+        internal_node_t &node = frame<internal_node_t>();
+        //自下而上，下一层重新计算过的汇总值已经写入，上一层可以由它算出
+        for (size_t d = path.size(); d-- > 0;)
+        {
+            size_t slot = search_slot(path[d], key);
+            off_t pos = aggregate_at(path[d], slot);
+            aggregate_t agg;
+            fetch(&agg, pos, sizeof(aggregate_t));
+            bool exact = removed == NULL || agg.subtract(*removed);
+            if (exact && added != NULL)
+                agg.add(*added);
+            if (!exact)
+            {
+                off_t child;
+                fetch(&child, payload_at(&node, path[d], slot), sizeof(off_t));
+                agg = d + 1 == path.size() ? aggregate_of(*view(&leaf, child))
+                                           : aggregate_of(*view(&node, child));
+            }
+            write(&agg, pos, sizeof(aggregate_t));
+        }
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::mark_stale(const leaf_node_t &leaf, off_t offset)
+    {
+        //只有一个叶子结点时它可以为空，任何key都落在其中
+        if (aggregated())
+        {
+            stale_t s = {0, offset, leaf.n > 0 ? leaf.keys[0] : key_t()};
+            stale.push_back(s);
+        }
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::mark_stale(const internal_node_t &node, off_t offset, size_t level)
+    {
+        //第一个分隔key落在结点的范围内；只有一个孩子的只能是根结点，没有父结点
+        if (aggregated() && node.n > 1)
+        {
+            stale_t s = {level, offset, node.keys[0]};
+            stale.push_back(s);
+        }
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::refresh_aggregates()
+    {
+        node_arena::scope_t scope(frames);
+        leaf_node_t &leaf = frame<leaf_node_t>();
+        internal_node_t &buf = frame<internal_node_t>();
+        path_t path;
+        while (!stale.empty())
+        {
+            //取出最低一层的结点，同一个结点只处理一次
+            std::sort(stale.begin(), stale.end(), [](const stale_t &a, const stale_t &b)
+                      { return a.level != b.level ? a.level < b.level : a.offset < b.offset; });
+            size_t level = stale[0].level, n = 0;
+            while (n < stale.size() && stale[n].level == level)
+                ++n;
+            std::vector<stale_t> current(stale.begin(), stale.begin() + n);
+            stale.erase(stale.begin(), stale.begin() + n);
+
+            //根结点没有父结点
+            if (level >= meta.height)
+                continue;
+            off_t done = 0;
+            for (size_t i = 0; i < current.size(); i++)
+            {
+                const stale_t &s = current[i];
+                //标记之后结点的key可能移到了兄弟结点，或者结点已被回收，此时key找不到该结点，
+                //同一个结点可能还有其他仍然有效的标记。同一个结点只处理一次
+                if (s.offset == done)
+                    continue;
+                search_index(s.key, &path);
+                off_t parent = path[meta.height - level - 1];
+                off_t node = level == 0 ? search_child(parent, s.key) : path[meta.height - level];
+                if (node != s.offset)
+                    continue;
+                done = node;
+
+                aggregate_t agg = level == 0 ? aggregate_of(*view(&leaf, node))
+                                             : aggregate_of(*view(&buf, node));
+                off_t pos = aggregate_at(parent, search_slot(parent, s.key));
+                aggregate_t old;
+                fetch(&old, pos, sizeof(aggregate_t));
+                if (!(old == agg))
+                    write(&agg, pos, sizeof(aggregate_t));
+                //即使这一层已经一致，同一事务中之后的增量修改可能先改正了这一层，
+                //而上层还缺少结构修改带来的变化，所以总是继续向上
+                stale_t up = {level + 1, parent, s.key};
+                stale.push_back(up);
+            }
+        }
+    }
+    /*
+    *******
+    批量操作
+    *******
+    */
+    BPT_TEMPLATE
+    template <class It>
+    int BPT_CLASS::bulk_load(It first, It last, double fill_factor)
+    {
+        //缓冲中的修改针对的是原来的数据，先合并再被新数据覆盖
+        drain();
+        std::unique_lock<std::shared_mutex> lock(latch);
+        //整棵树被重建，不加锁的查找在结束之前都会重试
+        lock_all_pages();
+        size_t order = meta.order;
+        size_t min_n = order / 2;
+        size_t fill = std::max(min_n, std::min((size_t)(order * fill_factor), order));
+
+        //清空文件，所有结点从文件头部开始顺序分配、顺序写入
+        bool aggregated = this->aggregated();
+        truncate_file();
+        reset_meta(order, aggregated);
+
+        //每个叶子结点在上一层中的索引项
+        std::vector<index_t> level;
+        //叶子结点写满时才写入上一个叶子结点，以便最后两个叶子结点可以平分
+        node_arena::scope_t scope(frames);
+        leaf_node_t &prev = frame<leaf_node_t>(), &leaf = frame<leaf_node_t>();
+        off_t prev_off = 0;
+        off_t leaf_off = alloc(&leaf);
+        leaf.prev = leaf.next = 0;
+        meta.leaf_offset = leaf_off;
+
+        for (; first != last; ++first)
+        {
+            record_t record = make_record(*first);
+            const key_t *last_key = leaf.n > 0 ? &leaf.keys[leaf.n - 1] : prev_off != 0 ? &prev.keys[prev.n - 1] : NULL;
+            if ((last_key != NULL && keycmp(*last_key, record.key) >= 0) || key_too_long(record.key))
+            {
+                //输入无序或key超长
+                truncate_file();
+                init_from_empty(order, aggregated);
+                if (transactional())
+                    make_checkpoint();
+                unlock_pages();
+                return -1;
+            }
+
+            if (leaf.n == fill)
+            {
+                if (prev_off != 0)
+                    write(&prev, prev_off);
+                index_t index;
+                index.key = begin(leaf)->key;
+                index.child = leaf_off;
+                index.agg = aggregate_of(leaf);
+                level.push_back(index);
+
+                prev = leaf;
+                prev_off = leaf_off;
+                leaf_off = prev.next = alloc(&leaf);
+                leaf.next = 0;
+                leaf.prev = prev_off;
+            }
+            begin(leaf)[leaf.n++] = record;
+        }
+
+        //最后一个叶子结点过小时与前一个合并或平分
+        if (prev_off != 0 && leaf.n < min_n)
+        {
+            if (prev.n + leaf.n <= order)
+            {
+                std::copy(begin(leaf), end(leaf), end(prev));
+                prev.n += leaf.n;
+                prev.next = 0;
+                //leaf是最后分配的结点，直接归还
+                --meta.leaf_node_num;
+                meta.slot = leaf_off;
+                level.pop_back();
+                leaf = prev;
+                leaf_off = prev_off;
+                prev_off = 0;
+            }
+            else
+            {
+                size_t total = prev.n + leaf.n;
+                size_t move = prev.n - (total - total / 2);
+                std::copy_backward(begin(leaf), end(leaf), end(leaf) + move);
+                std::copy(end(prev) - move, end(prev), begin(leaf));
+                prev.n -= move;
+                leaf.n += move;
+                level.back().agg = aggregate_of(prev);
+            }
+        }
+        if (prev_off != 0)
+            write(&prev, prev_off);
+        write(&leaf, leaf_off);
+        index_t index;
+        index.key = leaf.n > 0 ? begin(leaf)->key : key_t();
+        index.child = leaf_off;
+        index.agg = aggregate_of(leaf);
+        level.push_back(index);
+
+        //逐层向上建立内部结点，直到只剩根结点
+        do
+        {
+            bulk_build_level(level, fill);
+            meta.height++;
+        } while (level.size() > 1);
+        meta.root_offset = level[0].child;
+        write(&meta, OFFSET_META);
+        //批量建树不写日志，完成后直接落盘
+        if (transactional())
+            make_checkpoint();
+        unlock_pages();
+        return 0;
+    }
+    BPT_TEMPLATE
+    template <class It>
+    int BPT_CLASS::insert_batch(It first, It last)
+    {
+        //批量插入本身已经按叶子结点合并了写入，先合并写缓冲再直接写入B+树
+        drain();
+        //整批数据作为一条日志记录提交
+        txn_t txn(this);
+        std::vector<record_t> records;
+        for (; first != last; ++first)
+        {
+            records.push_back(make_record(*first));
+            if (key_too_long(records.back().key))
+                return -1;
+        }
+        //稳定排序，批内重复的key与逐个插入时一样先到者优先
+        std::stable_sort(records.begin(), records.end(), record_less());
+        return upsert_records(records.data(), records.data() + records.size(), false);
+    }
+    BPT_TEMPLATE
+    int BPT_CLASS::upsert_records(const record_t *i, const record_t *end, bool overwrite)
+    {
+        int changed = 0;
+        while (i != end)
+        {
+            //每个叶子结点只下降一次，上界之前的数据项都属于该结点
+            key_t fence;
+            bool bounded;
+            off_t offset = search_leaf(i->key, &fence, &bounded);
+            const record_t *j = bounded ? lower_bound(i, end, fence) : end;
+            changed += insert_records(offset, i, j, overwrite);
+            i = j;
+        }
+        return changed;
+    }
+    BPT_TEMPLATE
+    int BPT_CLASS::insert_records(off_t offset, const record_t *first, const record_t *last,
+                                  bool overwrite)
+    {
+        node_arena::scope_t scope(frames);
+        leaf_node_t &leaf = frame<leaf_node_t>();
+        fetch(&leaf, offset);
+
+        //合并结点中原有的数据项和新数据项
+        std::vector<record_t> merged;
+        merged.reserve(leaf.n + (last - first));
+        const_record_iterator old = begin(leaf);
+        int inserted = 0;
+        while (old != end(leaf) || first != last)
+        {
+            if (overwrite && first != last && old != end(leaf) && keycmp(old->key, first->key) == 0)
+            {
+                //覆盖已存在的key
+                merged.push_back(*first++);
+                ++old;
+                ++inserted;
+            }
+            else if (first == last || (old != end(leaf) && keycmp(old->key, first->key) <= 0))
+                merged.push_back(*old++);
+            else
+            {
+                //跳过已存在的key
+                if (merged.empty() || keycmp(merged.back().key, first->key) != 0)
+                {
+                    merged.push_back(*first);
+                    ++inserted;
+                }
+                ++first;
+            }
+        }
+        if (inserted == 0)
+            return 0;
+
+        size_t m = merged.size();
+        if (m <= meta.order)
+        {
+            std::copy(merged.begin(), merged.end(), begin(leaf));
+            leaf.n = m;
+            write(&leaf, offset);
+            mark_stale(leaf, offset);
+            return inserted;
+        }
+
+        //平均分裂成k个结点，每个结点都不低于下限。各结点依次在同一个帧中构造并写出，
+        //之后只需要它们的位置和第一个key
+        size_t k = (m + meta.order - 1) / meta.order;
+        std::vector<off_t> offsets(k);
+        std::vector<size_t> starts(k);
+        offsets[0] = offset;
+        off_t old_prev = leaf.prev, old_next = leaf.next;
+        for (size_t p = 1; p < k; p++)
+            offsets[p] = alloc(&leaf);
+        write(&meta, OFFSET_META);
+
+        size_t from = 0;
+        for (size_t p = 0; p < k; p++)
+        {
+            leaf.prev = p == 0 ? old_prev : offsets[p - 1];
+            leaf.next = p + 1 < k ? offsets[p + 1] : old_next;
+            leaf.n = m / k + (p < m % k ? 1 : 0);
+            std::copy(merged.begin() + from, merged.begin() + from + leaf.n, begin(leaf));
+            starts[p] = from;
+            from += leaf.n;
+            write(&leaf, offsets[p]);
+            mark_stale(leaf, offsets[p]);
+        }
+        if (old_next != 0)
+        {
+            fetch(&leaf, old_next, SIZE_NO_CHILDREN);
+            leaf.prev = offsets[k - 1];
+            write(&leaf, old_next, SIZE_NO_CHILDREN);
+        }
+
+        //依次在父结点中添加索引项。父结点分裂后前一个结点可能移到了新的父结点下，
+        //每次都重新查找：新结点的key此时仍落在前一个结点上
+        path_t path;
+        for (size_t p = 1; p < k; p++)
+        {
+            const key_t &key = merged[starts[p]].key;
+            search_index(key, &path);
+            insert_key_to_index(path, key, offsets[p - 1], offsets[p]);
+        }
+        return inserted;
+    }
+    BPT_TEMPLATE
+    template <class It>
+    int BPT_CLASS::bulk_load_parallel(It first, It last, size_t threads, double fill_factor)
+    {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        //读入所有数据项，随机访问的输入由各线程分段转换
+        std::vector<record_t> records;
+        if constexpr (is_random_access<It>::value)
+        {
+            records.resize(last - first);
+            parallel_for(records.size(), threads, [&](size_t b, size_t e)
+                         {
+                             for (size_t i = b; i < e; i++)
+                                 records[i] = make_record(first[i]);
+                         });
+        }
+        else
+        {
+            for (; first != last; ++first)
+                records.push_back(make_record(*first));
+        }
+        if (std::any_of(records.begin(), records.end(), [](const record_t &r)
+                        { return key_too_long(r.key); }))
+            return -1;
+        threads = std::max((size_t)1, std::min(threads, records.size() / BP_PARALLEL_GRAIN));
+        parallel_sort(records, threads);
+
+        drain();
+        std::unique_lock<std::shared_mutex> lock(latch);
+        lock_all_pages();
+        size_t order = meta.order;
+        size_t fill = std::max(order / 2, std::min((size_t)(order * fill_factor), order));
+        bool aggregated = this->aggregated();
+        truncate_file();
+        if (records.empty())
+            init_from_empty(order, aggregated);
+        else
+        {
+            reset_meta(order, aggregated);
+            //叶子结点连续分配，第i个结点的兄弟就是第i - 1和i + 1个结点
+            std::vector<size_t> groups = bulk_groups(records.size(), fill);
+            std::vector<off_t> offsets(groups.size());
+            std::vector<size_t> starts(groups.size());
+            {
+                node_arena::scope_t scope(frames);
+                leaf_node_t &leaf = frame<leaf_node_t>();
+                for (size_t i = 0; i < groups.size(); i++)
+                {
+                    offsets[i] = alloc(&leaf);
+                    starts[i] = i > 0 ? starts[i - 1] + groups[i - 1] : 0;
+                }
+            }
+            meta.leaf_offset = offsets[0];
+            reserve_storage();
+
+            std::vector<index_t> level(groups.size());
+            parallel_for(groups.size(), threads, [&](size_t b, size_t e)
+                         {
+                             //结点帧不能跨线程共用，每个线程使用自己的
+                             node_arena local(sizeof(leaf_node_t));
+                             leaf_node_t &leaf = *new (local.alloc()) leaf_node_t;
+                             leaf.order = meta.order;
+                             for (size_t i = b; i < e; i++)
+                             {
+                                 leaf.prev = i > 0 ? offsets[i - 1] : 0;
+                                 leaf.next = i + 1 < groups.size() ? offsets[i + 1] : 0;
+                                 leaf.n = groups[i];
+                                 std::copy(records.begin() + starts[i], records.begin() + starts[i] + leaf.n,
+                                           begin(leaf));
+                                 write(&leaf, offsets[i]);
+                                 level[i].key = leaf.keys[0];
+                                 level[i].child = offsets[i];
+                                 level[i].agg = aggregate_of(leaf);
+                             }
+                         });
+
+            do
+            {
+                bulk_build_level(level, fill, threads);
+                meta.height++;
+            } while (level.size() > 1);
+            meta.root_offset = level[0].child;
+            write(&meta, OFFSET_META);
+        }
+        if (transactional())
+            make_checkpoint();
+        unlock_pages();
+        return 0;
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::parallel_sort(std::vector<record_t> &records, size_t threads)
+    {
+        //stable_sort使相同的key保持输入中的顺序，去重时保留第一个
+        record_less less;
+        auto same = [](const record_t &l, const record_t &r)
+        { return keycmp(l.key, r.key) == 0; };
+        if (threads <= 1 || records.size() < threads)
+        {
+            if (!std::is_sorted(records.begin(), records.end(), less))
+                std::stable_sort(records.begin(), records.end(), less);
+            records.erase(std::unique(records.begin(), records.end(), same), records.end());
+            return;
+        }
+
+        //各线程排好自己的一段，已经有序的输入只需检查一遍
+        size_t n = records.size();
+        std::vector<size_t> bounds(threads + 1);
+        for (size_t t = 0; t <= threads; t++)
+            bounds[t] = n * t / threads;
+        parallel_for(threads, threads, [&](size_t b, size_t e)
+                     {
+                         for (size_t t = b; t < e; t++)
+                             if (!std::is_sorted(records.begin() + bounds[t], records.begin() + bounds[t + 1], less))
+                                 std::stable_sort(records.begin() + bounds[t], records.begin() + bounds[t + 1], less);
+                     });
+
+        //每段等距抽样，排序后选出threads - 1个分隔key
+        std::vector<record_t> samples;
+        for (size_t t = 0; t < threads; t++)
+            for (size_t j = 1; j <= BP_SORT_SAMPLES; j++)
+                samples.push_back(records[bounds[t] + (bounds[t + 1] - bounds[t]) * j / (BP_SORT_SAMPLES + 1)]);
+        std::sort(samples.begin(), samples.end(), less);
+        std::vector<key_t> splitters(threads - 1);
+        for (size_t r = 1; r < threads; r++)
+            splitters[r - 1] = samples[samples.size() * r / threads].key;
+
+        //cuts[t][r]为第t段中第r个范围的起点。按lower_bound划分，相同的key总在同一个范围
+        std::vector<std::vector<size_t> > cuts(threads, std::vector<size_t>(threads + 1));
+        for (size_t t = 0; t < threads; t++)
+        {
+            cuts[t][0] = bounds[t];
+            cuts[t][threads] = bounds[t + 1];
+            for (size_t r = 1; r < threads; r++)
+                cuts[t][r] = lower_bound(records.begin() + cuts[t][r - 1], records.begin() + bounds[t + 1],
+                                         splitters[r - 1]) -
+                             records.begin();
+        }
+        std::vector<size_t> starts(threads + 1, 0);
+        for (size_t r = 0; r < threads; r++)
+        {
+            starts[r + 1] = starts[r];
+            for (size_t t = 0; t < threads; t++)
+                starts[r + 1] += cuts[t][r + 1] - cuts[t][r];
+        }
+
+        //每个线程归并一个范围内各段的数据项，相同的key先取靠前的段，只保留第一个
+        std::vector<record_t> merged(n);
+        std::vector<size_t> unique(threads);
+        parallel_for(threads, threads, [&](size_t b, size_t e)
+                     {
+                         for (size_t r = b; r < e; r++)
+                         {
+                             std::vector<size_t> pos(threads);
+                             //堆顶为key最小、key相同时段号最小的段
+                             auto later = [&](size_t x, size_t y)
+                             {
+                                 int c = keycmp(records[pos[x]].key, records[pos[y]].key);
+                                 return c > 0 || (c == 0 && x > y);
+                             };
+                             std::vector<size_t> heap;
+                             for (size_t t = 0; t < threads; t++)
+                             {
+                                 pos[t] = cuts[t][r];
+                                 if (pos[t] < cuts[t][r + 1])
+                                     heap.push_back(t);
+                             }
+                             std::make_heap(heap.begin(), heap.end(), later);
+                             size_t out = starts[r];
+                             while (!heap.empty())
+                             {
+                                 std::pop_heap(heap.begin(), heap.end(), later);
+                                 size_t t = heap.back();
+                                 const record_t &record = records[pos[t]];
+                                 if (out == starts[r] || !same(merged[out - 1], record))
+                                     merged[out++] = record;
+                                 if (++pos[t] < cuts[t][r + 1])
+                                     std::push_heap(heap.begin(), heap.end(), later);
+                                 else
+                                     heap.pop_back();
+                             }
+                             unique[r] = out - starts[r];
+                         }
+                     });
+
+        //去重后各范围紧凑地写回records
+        std::vector<size_t> to(threads + 1, 0);
+        for (size_t r = 0; r < threads; r++)
+            to[r + 1] = to[r] + unique[r];
+        parallel_for(threads, threads, [&](size_t b, size_t e)
+                     {
+                         for (size_t r = b; r < e; r++)
+                             std::copy(merged.begin() + starts[r], merged.begin() + starts[r] + unique[r],
+                                       records.begin() + to[r]);
+                     });
+        records.resize(to[threads]);
+    }
+    BPT_TEMPLATE
+    std::vector<size_t> BPT_CLASS::bulk_groups(size_t count, size_t fill) const
+    {
+        std::vector<size_t> groups(count / fill, fill);
+        if (count % fill != 0)
+            groups.push_back(count % fill);
+        size_t k = groups.size();
+        if (k > 1 && groups[k - 1] < meta.order / 2)
+        {
+            size_t total = groups[k - 2] + groups[k - 1];
+            if (total <= meta.order)
+            {
+                groups.pop_back();
+                groups.back() = total;
+            }
+            else
+            {
+                groups[k - 2] = total - total / 2;
+                groups[k - 1] = total / 2;
+            }
+        }
+        return groups;
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::bulk_build_level(std::vector<index_t> &level, size_t fill, size_t threads)
+    {
+        std::vector<size_t> groups = bulk_groups(level.size(), fill);
+
+        //同一层的结点连续分配，便于设置兄弟指针
+        std::vector<off_t> offsets(groups.size());
+        std::vector<size_t> starts(groups.size());
+        {
+            node_arena::scope_t scope(frames);
+            internal_node_t &node = frame<internal_node_t>();
+            for (size_t i = 0; i < groups.size(); i++)
+            {
+                offsets[i] = alloc(&node);
+                starts[i] = i > 0 ? starts[i - 1] + groups[i - 1] : 0;
+            }
+        }
+        reserve_storage();
+
+        std::vector<index_t> upper(groups.size());
+        parallel_for(groups.size(), threads, [&](size_t b, size_t e)
+                     {
+                         node_arena local(sizeof(internal_node_t));
+                         internal_node_t &node = *new (local.alloc()) internal_node_t;
+                         node.order = meta.order;
+                         for (size_t i = b; i < e; i++)
+                         {
+                             size_t child = starts[i];
+                             node.prev = i > 0 ? offsets[i - 1] : 0;
+                             node.next = i + 1 < groups.size() ? offsets[i + 1] : 0;
+                             node.n = groups[i];
+                             //分隔key为下一个孩子结点的最小key，最后一项的key不使用
+                             for (size_t j = 0; j < node.n; j++)
+                             {
+                                 node.children()[j] = level[child + j].child;
+                                 node.aggs()[j] = level[child + j].agg;
+                                 if (j + 1 < node.n)
+                                     node.keys[j] = level[child + j + 1].key;
+                             }
+                             write(&node, offsets[i]);
+
+                             upper[i].key = level[child].key;
+                             upper[i].child = offsets[i];
+                             upper[i].agg = aggregate_of(node);
+                         }
+                     });
+        level.swap(upper);
+    }
+
+    /*
+    *******
+    写缓冲
+    *******
+    */
+    BPT_TEMPLATE
+    int BPT_CLASS::write_buffered(buffer_op_t op, const key_t &key, const value_t &value)
+    {
+        size_t size;
+        {
+            std::lock_guard<std::mutex> lock(key_lock(key));
+            typename buffer_t::guard_t guard(buffer);
+            //与直接修改B+树的返回值一致：插入已存在的key返回1，
+            //更新、删除不存在的key返回-1（更新时其后还有数据项返回1）
+            value_t old;
+            int state = buffer.get(key, &old);
+            if (state < 0)
+                state = search_tree(key, &old);
+            if (op == BUFFER_INSERT && state == 0)
+                return 1;
+            if (op != BUFFER_INSERT && state != 0)
+                return op == BUFFER_UPDATE && state > 0 ? 1 : -1;
+            size = buffer.put(key, value, op == BUFFER_REMOVE);
+        }
+        //后台线程跟不上时由写者自己合并，限制缓冲占用的内存
+        if (size >= 2 * buffer_size)
+            drain();
+        else if (size >= buffer_size)
+            request_drain();
+        return 0;
+    }
+    BPT_TEMPLATE
+    int BPT_CLASS::drain()
+    {
+        if (buffer_size == 0)
+            return 0;
+        std::lock_guard<std::mutex> lock(drain_latch);
+        const typename buffer_t::list_t *list = buffer.freeze();
+        if (list == NULL)
+            return 0;
+
+        //每个key只取最新的修改，写入按叶子结点分组，删除逐个进行
+        std::vector<record_t> records;
+        std::vector<key_t> removed;
+        for (const typename buffer_t::entry_t *e = list->first(); e != NULL; e = list->next(e))
+            if (e->removed)
+                removed.push_back(e->key);
+            else
+            {
+                record_t record;
+                record.key = e->key;
+                record.value = e->value;
+                records.push_back(record);
+            }
+        {
+            txn_t txn(this);
+            upsert_records(records.data(), records.data() + records.size(), true);
+            for (size_t i = 0; i < removed.size(); i++)
+                remove_key(removed[i]);
+        }
+        //合并完成后查找不再需要冻结的跳表
+        buffer.release();
+        return records.size() + removed.size();
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::request_drain()
+    {
+        {
+            std::lock_guard<std::mutex> lock(drain_mutex);
+            drain_requested = true;
+        }
+        drain_wake.notify_one();
+    }
+    BPT_TEMPLATE
+    void BPT_CLASS::drain_loop()
+    {
+        std::unique_lock<std::mutex> lock(drain_mutex);
+        while (true)
+        {
+            drain_wake.wait(lock, [&] { return drain_stop || drain_requested; });
+            if (drain_stop)
+                break;
+            drain_requested = false;
+            lock.unlock();
+            drain();
+            lock.lock();
+        }
+    }
+
+#undef BPT_CLASS
+#undef BPT_TEMPLATE
+}
+#endif
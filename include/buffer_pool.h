@@ -0,0 +1,102 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <list>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+
+namespace BPT
+{
+//缓存页大小，按页对齐以便直接I/O
+#define BP_PAGE_SIZE 4096
+//默认缓存的页面个数（4MB）
+#define BP_CACHE_PAGES 1024
+//缓存的分片数，每个分片有独立的锁和LRU表
+#define BP_CACHE_SHARDS 16
+
+    //页缓存的后端存储接口
+    class page_io
+    {
+    public:
+        virtual ~page_io() {}
+        //读取offset处的一页，返回实际读到的字节数，出错返回-1
+        virtual ssize_t read_page(void *page, off_t offset, size_t size) const = 0;
+        //写入offset处的一页，返回实际写入的字节数，出错返回-1
+        virtual ssize_t write_page(const void *page, off_t offset, size_t size) const = 0;
+    };
+
+    //固定容量的页缓存，以页偏移量为键，LRU换出，脏页在换出或flush时写回。
+    //页面按偏移量分散到若干分片，每个分片由自己的互斥量保护，
+    //所有接口可以被多个线程同时调用，访问不同分片的线程互不阻塞
+    class buffer_pool
+    {
+    public:
+        buffer_pool(const page_io *io, size_t capacity = BP_CACHE_PAGES);
+        ~buffer_pool();
+
+        //按字节读写，跨页时自动拆分，成功返回0
+        int read(void *block, off_t offset, size_t size);
+        int write(const void *block, off_t offset, size_t size);
+
+        //固定一页并返回其内容，被固定的页面不会被换出
+        char *pin(off_t page);
+        //释放一页，dirty表示该页在固定期间被修改过
+        void unpin(off_t page, bool dirty = false);
+
+        //将所有脏页写回，成功返回0
+        int flush();
+        //丢弃所有页面（不写回），用于文件被截断之后
+        void reset();
+
+        //命中与缺失次数统计
+        size_t hits() const;
+        size_t misses() const;
+
+    private:
+        struct frame_t
+        {
+            off_t page;   //页面在文件中的偏移量
+            char *data;   //页面内容
+            size_t valid; //页面中有效（文件中已存在）的字节数
+            int pin;      //固定计数
+            bool dirty;
+            std::list<frame_t *>::iterator lru;
+        };
+
+        buffer_pool(const buffer_pool &);
+        buffer_pool &operator=(const buffer_pool &);
+
+        //分片独占一个缓存行，避免不同分片的锁互相干扰
+        struct alignas(64) shard_t
+        {
+            shard_t() : hits(0), misses(0) {}
+
+            mutable std::mutex mutex;
+            std::vector<frame_t *> free_frames;
+            std::list<frame_t *> lru; //表头为最近使用的页面
+            std::unordered_map<off_t, frame_t *> table;
+            size_t hits;
+            size_t misses;
+        };
+
+        shard_t &shard_of(off_t page)
+        {
+            return shards[(page / BP_PAGE_SIZE) % shards.size()];
+        }
+
+        //查找或载入页面，返回对应的frame，并将其移至LRU表头
+        frame_t *fetch(shard_t &shard, off_t page);
+        //选出一个可用的frame，必要时换出最久未使用的页面
+        frame_t *victim(shard_t &shard);
+        int write_back(frame_t *frame);
+
+        const page_io *io;
+        size_t capacity;
+        std::vector<frame_t> frames;
+        std::vector<shard_t> shards;
+    };
+}
+#endif
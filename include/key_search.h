@@ -0,0 +1,184 @@
+#ifndef KEY_SEARCH_H
+#define KEY_SEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits>
+#include <type_traits>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+namespace BPT
+{
+//二分查找把范围缩小到该个数的key之后改为一次比较整段的key。
+//AVX2、SSE4.2需要编译时打开（如-march=native），否则使用SSE2或标量比较
+#define BP_SEARCH_WINDOW 32
+
+    //二分查找下一步只会访问两个位置之一，在比较之前同时预取两者，
+    //key数组连续存放时访存可以与比较重叠，不必等到选出下一段
+    template <class Key>
+    inline void prefetch(const Key *base, size_t n, size_t half)
+    {
+        size_t next = (n - half) / 2;
+        __builtin_prefetch(base + next);
+        __builtin_prefetch(base + half + next);
+    }
+
+    //在结点连续存放的key数组中查找，Compare是三路比较函数。
+    //二分查找每一步用条件传送选择下一段，不依赖难以预测的分支。
+    //可以对特定的Key和Compare特化，Enable用于按条件特化
+    template <class Key, class Compare, class Enable = void>
+    struct key_search
+    {
+        //第一个不小于key的下标
+        static size_t lower_bound(const Key *keys, size_t n, const Key &key)
+        {
+            return search<false>(keys, n, key);
+        }
+        //第一个大于key的下标
+        static size_t upper_bound(const Key *keys, size_t n, const Key &key)
+        {
+            return search<true>(keys, n, key);
+        }
+
+    private:
+        //upper为真时查找第一个大于key的下标，否则查找第一个不小于key的下标
+        template <bool upper>
+        static bool before(const Key &k, const Key &key)
+        {
+            int c = Compare()(k, key);
+            return upper ? c <= 0 : c < 0;
+        }
+        template <bool upper>
+        static size_t search(const Key *keys, size_t n, const Key &key)
+        {
+            if (n == 0)
+                return 0;
+            //结果始终在[base, base + n]中
+            const Key *base = keys;
+            while (n > 1)
+            {
+                size_t half = n / 2;
+                prefetch(base, n, half);
+                base = before<upper>(base[half], key) ? base + half : base;
+                n -= half;
+            }
+            return base - keys + before<upper>(*base, key);
+        }
+    };
+
+    //整数key按默认顺序比较时，先二分查找到BP_SEARCH_WINDOW个key以内，
+    //再用SIMD比较整段key，由比较结果的掩码计算位置
+    template <class Int>
+    struct int_search
+    {
+        static_assert(std::is_integral<Int>::value, "integer keys only");
+
+        static size_t lower_bound(const Int *keys, size_t n, Int key)
+        {
+            return search<false>(keys, n, key);
+        }
+        static size_t upper_bound(const Int *keys, size_t n, Int key)
+        {
+            return search<true>(keys, n, key);
+        }
+
+    private:
+        template <bool upper>
+        static size_t search(const Int *keys, size_t n, Int key)
+        {
+            const Int *base = keys;
+            while (n > BP_SEARCH_WINDOW)
+            {
+                size_t half = n / 2;
+                prefetch(base, n, half);
+                base = (upper ? base[half] <= key : base[half] < key) ? base + half : base;
+                n -= half;
+            }
+            return base - keys + count<upper>(base, n, key);
+        }
+        //有序的n个key中小于（upper为真时小于等于）key的个数
+        template <bool upper>
+        static size_t count(const Int *keys, size_t n, Int key)
+        {
+            size_t i = 0, c = 0;
+#ifdef __SSE2__
+            simd_count<upper>(keys, n, key, &i, &c);
+#endif
+            for (; i < n; i++)
+                c += upper ? keys[i] <= key : keys[i] < key;
+            return c;
+        }
+#ifdef __SSE2__
+        //有符号比较，无符号整数先翻转最高位。小于等于key即小于key + 1，
+        //key为最大值时没有更大的数，此时交给标量部分处理
+        template <bool upper>
+        static void simd_count(const Int *keys, size_t n, Int key, size_t *i, size_t *c)
+        {
+            typedef typename std::make_signed<Int>::type sint_t;
+            const Int flip = std::is_signed<Int>::value ? 0 : (Int)((Int)1 << (sizeof(Int) * 8 - 1));
+            if (upper)
+            {
+                if (key == std::numeric_limits<Int>::max())
+                    return;
+                ++key;
+            }
+            sint_t k = (sint_t)(key ^ flip);
+            if (sizeof(Int) == 8)
+                count64(keys, n, (int64_t)k, (uint64_t)flip, i, c);
+            else if (sizeof(Int) == 4)
+                count32(keys, n, (int32_t)k, (uint32_t)flip, i, c);
+        }
+        static void count64(const Int *keys, size_t n, int64_t k, uint64_t flip, size_t *i, size_t *c)
+        {
+#if defined(__AVX2__)
+            const __m256i target = _mm256_set1_epi64x(k);
+            const __m256i bias = _mm256_set1_epi64x((int64_t)flip);
+            for (; *i + 4 <= n; *i += 4)
+            {
+                __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(keys + *i)), bias);
+                //key > v的位置即v < key
+                int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(target, v)));
+                *c += __builtin_popcount(mask);
+            }
+#elif defined(__SSE4_2__)
+            const __m128i target = _mm_set1_epi64x(k);
+            const __m128i bias = _mm_set1_epi64x((int64_t)flip);
+            for (; *i + 2 <= n; *i += 2)
+            {
+                __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(keys + *i)), bias);
+                int mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(target, v)));
+                *c += __builtin_popcount(mask);
+            }
+#else
+            //SSE2没有64位比较，交给标量部分
+            (void)keys, (void)n, (void)k, (void)flip, (void)i, (void)c;
+#endif
+        }
+        static void count32(const Int *keys, size_t n, int32_t k, uint32_t flip, size_t *i, size_t *c)
+        {
+#if defined(__AVX2__)
+            const __m256i target = _mm256_set1_epi32(k);
+            const __m256i bias = _mm256_set1_epi32((int32_t)flip);
+            for (; *i + 8 <= n; *i += 8)
+            {
+                __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(keys + *i)), bias);
+                int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(target, v)));
+                *c += __builtin_popcount(mask);
+            }
+#else
+            const __m128i target = _mm_set1_epi32(k);
+            const __m128i bias = _mm_set1_epi32((int32_t)flip);
+            for (; *i + 4 <= n; *i += 4)
+            {
+                __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(keys + *i)), bias);
+                int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(target, v)));
+                *c += __builtin_popcount(mask);
+            }
+#endif
+        }
+#endif
+    };
+}
+#endif
@@ -0,0 +1,80 @@
+#ifndef NODE_ARENA_H
+#define NODE_ARENA_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+
+namespace BPT
+{
+//每块slab包含的结点帧个数
+#define BP_ARENA_SLAB 16
+//结点帧按缓存行对齐
+#define BP_ARENA_ALIGN 64
+
+    //修改操作使用的结点帧，按栈的顺序分配和释放。
+    //帧分配在按块申请的内存中，释放后留给之后的操作复用，稳定之后不再申请内存。
+    //不加锁，只能由持有B+树独占的线程使用
+    class node_arena
+    {
+    public:
+        explicit node_arena(size_t frame_size)
+            : frame_size((frame_size + BP_ARENA_ALIGN - 1) / BP_ARENA_ALIGN * BP_ARENA_ALIGN), used(0)
+        {
+        }
+        ~node_arena()
+        {
+            for (size_t i = 0; i < slabs.size(); i++)
+                free(slabs[i]);
+        }
+
+        //分配一个帧，内容未初始化
+        void *alloc()
+        {
+            size_t slab = used / BP_ARENA_SLAB;
+            if (slab == slabs.size())
+            {
+                void *memory = NULL;
+                if (posix_memalign(&memory, BP_ARENA_ALIGN, frame_size * BP_ARENA_SLAB) != 0)
+                    throw std::bad_alloc();
+                slabs.push_back((char *)memory);
+            }
+            return slabs[slab] + (used++ % BP_ARENA_SLAB) * frame_size;
+        }
+
+        //作用域内分配的帧在离开作用域时一起释放
+        class scope_t
+        {
+        public:
+            explicit scope_t(node_arena &arena) : arena(arena), mark(arena.used) {}
+            ~scope_t()
+            {
+                arena.used = mark;
+            }
+
+        private:
+            node_arena &arena;
+            size_t mark;
+        };
+
+        //已申请的帧个数和正在使用的帧个数
+        size_t capacity() const
+        {
+            return slabs.size() * BP_ARENA_SLAB;
+        }
+        size_t in_use() const
+        {
+            return used;
+        }
+
+    private:
+        node_arena(const node_arena &);
+        node_arena &operator=(const node_arena &);
+
+        size_t frame_size;
+        std::vector<char *> slabs;
+        size_t used;
+    };
+}
+#endif
@@ -0,0 +1,117 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <atomic>
+#include "buffer_pool.h"
+
+namespace BPT
+{
+    //数据库文件，在B+树的整个生命周期内保持打开。
+    //使用pread/pwrite读写，没有共享的文件位置，可以被多个线程同时使用。
+    class file_t : public page_io
+    {
+    public:
+        file_t();
+        ~file_t();
+
+        //打开（必要时创建）文件，direct为真时尝试使用O_DIRECT绕过系统缓存
+        int open(const char *path, bool direct = false);
+        void close();
+        //截断文件为空
+        int truncate();
+        //返回文件大小，出错返回-1
+        off_t size() const;
+        //将数据刷入磁盘
+        int sync() const;
+        //提示系统预读[offset, offset + size)，O_DIRECT绕过系统缓存，此时不做任何事
+        int advise(off_t offset, size_t size) const;
+
+        ssize_t read_page(void *page, off_t offset, size_t size) const;
+        ssize_t write_page(const void *page, off_t offset, size_t size) const;
+
+        int fd;
+        //是否真正使用了O_DIRECT（部分文件系统不支持）
+        bool direct;
+
+    private:
+        file_t(const file_t &);
+        file_t &operator=(const file_t &);
+    };
+
+//映射区域初次建立时的最小长度
+#define BP_MMAP_MIN_SIZE (BP_PAGE_SIZE * 256)
+//预留的地址空间大小，文件在此范围内扩展时映射的起始地址不变
+#define BP_MMAP_RESERVE ((size_t)1 << 40)
+
+    //将整个文件映射到内存。映射时预留BP_MMAP_RESERVE的地址空间，
+    //写入超出末尾时用ftruncate扩展文件并在预留的地址上映射新增的部分，
+    //已有的地址始终有效，其他线程可以在扩展的同时读取映射。
+    //无法预留地址空间时退回到mremap，此时扩展可能移动整个映射。
+    //也可以不对应文件，只在匿名内存中分配，扩展方式相同
+    class mapping_t
+    {
+    public:
+        mapping_t();
+        ~mapping_t();
+
+        //映射整个文件，文件小于BP_MMAP_MIN_SIZE时先将其扩展
+        int map(const file_t *file);
+        //分配BP_MMAP_MIN_SIZE的匿名内存，不对应任何文件
+        int map_anonymous();
+        void unmap();
+        //保证映射覆盖[0, size)
+        int grow(off_t size);
+
+        //与buffer_pool相同的读写接口，成功返回0。
+        //write按对齐的字原子地写入，与并发的load_words之间不构成数据竞争
+        int read(void *block, off_t offset, size_t size) const;
+        int write(const void *block, off_t offset, size_t size);
+        //按对齐的字原子地读取映射中src处的数据，用于不加锁的读者，不做越界检查。
+        //读到的内容可能混有并发写入的新旧数据，由调用者检查版本号。
+        //按8字节对齐的字逐个复制，首尾不足一个字的部分逐字节复制
+        static void load_words(void *block, const char *src, size_t size)
+        {
+            char *dst = (char *)block;
+            for (; size > 0 && (uintptr_t)src % sizeof(uint64_t) != 0; size--)
+                *dst++ = __atomic_load_n(src++, __ATOMIC_RELAXED);
+            for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t))
+            {
+                uint64_t word = __atomic_load_n((const uint64_t *)src, __ATOMIC_RELAXED);
+                memcpy(dst, &word, sizeof(uint64_t));
+                src += sizeof(uint64_t);
+                dst += sizeof(uint64_t);
+            }
+            for (; size > 0; size--)
+                *dst++ = __atomic_load_n(src++, __ATOMIC_RELAXED);
+        }
+        //提示系统预先载入[offset, offset + size)对应的页面
+        int advise(off_t offset, size_t size) const;
+        //将映射中修改过的页面写入磁盘
+        int sync() const;
+
+        //offset处数据在内存中的地址，不做越界检查
+        char *at(off_t offset) const
+        {
+            return base + offset;
+        }
+        //扩展映射时起始地址是否保持不变
+        bool stable() const
+        {
+            return reserved != 0;
+        }
+
+        char *base;
+        std::atomic<size_t> length;
+        size_t reserved; //预留的地址空间大小，没有预留时为0
+
+    private:
+        mapping_t(const mapping_t &);
+        mapping_t &operator=(const mapping_t &);
+
+        const file_t *file;
+    };
+}
+#endif
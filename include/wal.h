@@ -0,0 +1,105 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "buffer_pool.h"
+#include "storage.h"
+
+namespace BPT
+{
+//日志超过该大小时做检查点
+#define BP_WAL_CHECKPOINT_SIZE (64 * 1024 * 1024)
+//异步模式下后台线程刷盘的间隔（毫秒）
+#define BP_WAL_ASYNC_INTERVAL 10
+
+    //日志的落盘方式
+    enum wal_mode_t
+    {
+        WAL_OFF,   //不写日志，结点原地修改
+        WAL_ASYNC, //提交时只写入日志文件，由后台线程定期刷盘
+        WAL_GROUP, //提交时等待后台线程刷盘，同时提交的写者共用一次fdatasync
+        WAL_SYNC   //每次提交都在当前线程fdatasync
+    };
+
+    //CRC32校验和，crc为之前部分的校验和
+    uint32_t checksum(const void *data, size_t size, uint32_t crc = 0);
+
+    //以页面映像为单位的重做日志。一次修改涉及的所有页面作为一条记录整体写入，
+    //记录带有校验和。打开时按顺序重做完整的记录，遇到不完整的记录即停止。
+    class wal_t
+    {
+    public:
+        wal_t();
+        ~wal_t();
+
+        //打开（必要时创建）日志文件，WAL_ASYNC和WAL_GROUP模式启动后台刷盘线程
+        int open(const char *path, wal_mode_t mode);
+        void close();
+        bool enabled() const
+        {
+            return mode != WAL_OFF;
+        }
+
+        //将日志中完整的记录按顺序写入io，返回重做的记录个数，出错返回-1
+        int replay(const page_io *io);
+        //追加一条记录，包含count个按页对齐的偏移量及其BP_PAGE_SIZE字节的内容。
+        //返回记录的lsn（记录末尾的位置），出错返回0
+        uint64_t append(const off_t *offsets, const char *const *pages, size_t count);
+        //按日志模式等待lsn之前的记录落盘
+        int commit(uint64_t lsn);
+        //等待所有已追加的记录落盘
+        int sync();
+        //数据文件落盘后清空日志
+        int reset();
+        //日志当前的长度
+        uint64_t size();
+
+    private:
+        wal_t(const wal_t &);
+        wal_t &operator=(const wal_t &);
+
+        //后台刷盘线程
+        void run();
+
+        file_t file;
+        wal_mode_t mode;
+        std::mutex mutex;
+        std::condition_variable wake; //唤醒后台线程
+        std::condition_variable done; //通知等待落盘的写者
+        std::thread thread;
+        //lsn在清空日志后继续增长，等待落盘的写者不会因为清空而错过通知
+        uint64_t start;     //日志文件开头对应的lsn
+        uint64_t appended;  //已写入日志文件的末尾对应的lsn
+        uint64_t durable;   //已落盘的lsn
+        uint64_t requested; //写者等待落盘的最大lsn
+        bool stop;
+        bool failed;
+    };
+
+    //写回数据页之前保证日志已经落盘
+    class wal_io : public page_io
+    {
+    public:
+        wal_io(const page_io *io, wal_t *wal) : io(io), wal(wal) {}
+
+        ssize_t read_page(void *page, off_t offset, size_t size) const
+        {
+            return io->read_page(page, offset, size);
+        }
+        ssize_t write_page(const void *page, off_t offset, size_t size) const
+        {
+            if (wal->enabled() && wal->sync() != 0)
+                return -1;
+            return io->write_page(page, offset, size);
+        }
+
+    private:
+        const page_io *io;
+        wal_t *wal;
+    };
+}
+#endif
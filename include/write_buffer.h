@@ -0,0 +1,295 @@
+#ifndef WRITE_BUFFER_H
+#define WRITE_BUFFER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <functional>
+
+namespace BPT
+{
+//跳表的最大层数
+#define BP_SKIPLIST_HEIGHT 16
+//读写写缓冲的线程按线程号分散登记到的槽数
+#define BP_BUFFER_SLOTS 64
+
+    //无锁的有序跳表，只插入不删除，整个跳表一起释放。
+    //同一个key的每次修改都插入一个新的数据项，按key升序、序号降序排列，
+    //最先遇到的就是最新的修改。插入和查找可以被多个线程同时调用
+    template <class Key, class Value, class Compare>
+    class skiplist_t
+    {
+    public:
+        struct entry_t
+        {
+            Key key;
+            Value value;
+            uint64_t seq;
+            bool removed; //删除标记
+            int height;
+            std::atomic<entry_t *> next[1]; //实际长度为height
+        };
+
+        skiplist_t() : head(create(Key(), Value(), 0, false, BP_SKIPLIST_HEIGHT)), count(0) {}
+        ~skiplist_t()
+        {
+            entry_t *e = head;
+            while (e != NULL)
+            {
+                entry_t *next = e->next[0].load(std::memory_order_relaxed);
+                destroy(e);
+                e = next;
+            }
+        }
+
+        //插入一次修改，seq由调用者保证对同一个key递增
+        void insert(const Key &key, const Value &value, uint64_t seq, bool removed)
+        {
+            entry_t *entry = create(key, value, seq, removed, random_height(seq));
+            entry_t *preds[BP_SKIPLIST_HEIGHT], *succs[BP_SKIPLIST_HEIGHT];
+            locate(key, seq, preds, succs);
+            //先链入底层，之后逐层向上链入，某一层失败时重新定位
+            for (int level = 0; level < entry->height; level++)
+                while (true)
+                {
+                    entry->next[level].store(succs[level], std::memory_order_relaxed);
+                    entry_t *expected = succs[level];
+                    if (preds[level]->next[level].compare_exchange_strong(
+                            expected, entry, std::memory_order_release, std::memory_order_relaxed))
+                        break;
+                    locate(key, seq, preds, succs);
+                }
+            count.fetch_add(1, std::memory_order_relaxed);
+        }
+        //第一个key不小于key的数据项，即key的最新修改或其后的第一个数据项
+        const entry_t *lower_bound(const Key &key) const
+        {
+            entry_t *preds[BP_SKIPLIST_HEIGHT], *succs[BP_SKIPLIST_HEIGHT];
+            locate(key, UINT64_MAX, preds, succs);
+            return succs[0];
+        }
+        const entry_t *first() const
+        {
+            return head->next[0].load(std::memory_order_acquire);
+        }
+        //下一个不同key的数据项，跳过同一个key较早的修改
+        const entry_t *next(const entry_t *entry) const
+        {
+            const entry_t *e = entry->next[0].load(std::memory_order_acquire);
+            while (e != NULL && compare(e->key, entry->key) == 0)
+                e = e->next[0].load(std::memory_order_acquire);
+            return e;
+        }
+        //数据项的个数（包括同一个key较早的修改）
+        size_t size() const
+        {
+            return count.load(std::memory_order_relaxed);
+        }
+
+    private:
+        skiplist_t(const skiplist_t &);
+        skiplist_t &operator=(const skiplist_t &);
+
+        static entry_t *create(const Key &key, const Value &value, uint64_t seq, bool removed, int height)
+        {
+            void *memory = malloc(sizeof(entry_t) + (height - 1) * sizeof(std::atomic<entry_t *>));
+            if (memory == NULL)
+                throw std::bad_alloc();
+            entry_t *e = (entry_t *)memory;
+            e->key = key;
+            e->value = value;
+            e->seq = seq;
+            e->removed = removed;
+            e->height = height;
+            for (int i = 0; i < height; i++)
+                new (&e->next[i]) std::atomic<entry_t *>(NULL);
+            return e;
+        }
+        static void destroy(entry_t *e)
+        {
+            free(e);
+        }
+        //每层以1/4的概率向上延伸，由序号散列得到，不需要线程私有的随机数
+        static int random_height(uint64_t seq)
+        {
+            uint64_t r = (seq + 1) * 0x9e3779b97f4a7c15ULL;
+            r ^= r >> 31;
+            int height = 1;
+            while (height < BP_SKIPLIST_HEIGHT && (r & 3) == 0)
+            {
+                ++height;
+                r >>= 2;
+            }
+            return height;
+        }
+        //(key, seq)是否排在entry之后
+        bool after(const entry_t *entry, const Key &key, uint64_t seq) const
+        {
+            int c = compare(entry->key, key);
+            return c < 0 || (c == 0 && entry->seq > seq);
+        }
+        //找到每一层中(key, seq)的前驱和后继
+        void locate(const Key &key, uint64_t seq, entry_t **preds, entry_t **succs) const
+        {
+            entry_t *x = head;
+            for (int level = BP_SKIPLIST_HEIGHT - 1; level >= 0; level--)
+            {
+                entry_t *next = x->next[level].load(std::memory_order_acquire);
+                while (next != NULL && after(next, key, seq))
+                {
+                    x = next;
+                    next = x->next[level].load(std::memory_order_acquire);
+                }
+                preds[level] = x;
+                succs[level] = next;
+            }
+        }
+
+        Compare compare;
+        entry_t *head;
+        std::atomic<size_t> count;
+    };
+
+    //B+树前的写缓冲：修改先写入活动跳表，写满后冻结，由后台线程合并入B+树，
+    //合并期间新的修改写入新的活动跳表。查找依次检查活动跳表、冻结跳表和B+树。
+    //访问跳表的线程必须持有guard_t，跳表被替换之后，等到此前登记的线程都退出才被合并或释放
+    template <class Key, class Value, class Compare>
+    class write_buffer
+    {
+    public:
+        typedef skiplist_t<Key, Value, Compare> list_t;
+        typedef typename list_t::entry_t entry_t;
+
+        write_buffer() : active(new list_t), frozen(NULL), seq(0), epoch(0)
+        {
+            for (int e = 0; e < 2; e++)
+                for (size_t i = 0; i < BP_BUFFER_SLOTS; i++)
+                    slots[e][i].readers.store(0, std::memory_order_relaxed);
+        }
+        ~write_buffer()
+        {
+            delete active.load();
+            delete frozen.load();
+        }
+
+        //登记一次访问，访问同一个槽的线程才会互相干扰
+        class guard_t
+        {
+        public:
+            explicit guard_t(const write_buffer &buffer)
+                : buffer(buffer),
+                  slot(std::hash<std::thread::id>()(std::this_thread::get_id()) % BP_BUFFER_SLOTS),
+                  epoch(buffer.epoch.load(std::memory_order_seq_cst))
+            {
+                buffer.slots[epoch][slot].readers.fetch_add(1, std::memory_order_seq_cst);
+            }
+            ~guard_t()
+            {
+                buffer.slots[epoch][slot].readers.fetch_sub(1, std::memory_order_release);
+            }
+
+        private:
+            const write_buffer &buffer;
+            size_t slot;
+            int epoch;
+        };
+
+        //查找key的最新修改：返回0表示存在并写入value，1表示已被删除，-1表示不在缓冲中
+        int get(const Key &key, Value *value) const
+        {
+            const list_t *lists[2] = {active.load(std::memory_order_seq_cst),
+                                      frozen.load(std::memory_order_seq_cst)};
+            for (int i = 0; i < 2; i++)
+            {
+                if (lists[i] == NULL)
+                    continue;
+                const entry_t *e = lists[i]->lower_bound(key);
+                if (e != NULL && compare(e->key, key) == 0)
+                {
+                    if (e->removed)
+                        return 1;
+                    *value = e->value;
+                    return 0;
+                }
+            }
+            return -1;
+        }
+        //写入一次修改，同一个key的修改由调用者串行化。返回活动跳表的数据项个数
+        size_t put(const Key &key, const Value &value, bool removed)
+        {
+            list_t *list = active.load(std::memory_order_seq_cst);
+            list->insert(key, value, seq.fetch_add(1, std::memory_order_relaxed), removed);
+            return list->size();
+        }
+        size_t size() const
+        {
+            const list_t *list = frozen.load(std::memory_order_seq_cst);
+            return active.load(std::memory_order_seq_cst)->size() + (list != NULL ? list->size() : 0);
+        }
+        //访问两个跳表，调用者需持有guard_t
+        const list_t *active_list() const
+        {
+            return active.load(std::memory_order_seq_cst);
+        }
+        const list_t *frozen_list() const
+        {
+            return frozen.load(std::memory_order_seq_cst);
+        }
+
+        //冻结活动跳表并换上新的跳表，等待仍可能写入它的线程退出后返回，
+        //活动跳表为空时返回NULL。冻结、释放由同一个线程串行调用
+        const list_t *freeze()
+        {
+            if (active.load()->size() == 0)
+                return NULL;
+            list_t *list = active.load();
+            frozen.store(list, std::memory_order_seq_cst);
+            active.store(new list_t, std::memory_order_seq_cst);
+            synchronize();
+            return list;
+        }
+        //冻结跳表已合并入B+树，等待仍在读它的线程退出后释放
+        void release()
+        {
+            list_t *list = frozen.load();
+            frozen.store(NULL, std::memory_order_seq_cst);
+            synchronize();
+            delete list;
+        }
+
+    private:
+        write_buffer(const write_buffer &);
+        write_buffer &operator=(const write_buffer &);
+
+        //等待替换跳表之前登记的线程全部退出。每次切换登记用的计数器后等待旧的计数器归零，
+        //新登记的线程不会让等待无限延长；登记时读到旧计数器、切换后才计数的线程
+        //一定能看到新的跳表，但可能留在另一个计数器中，所以切换两次
+        void synchronize()
+        {
+            for (int round = 0; round < 2; round++)
+            {
+                int old = epoch.load();
+                epoch.store(1 - old, std::memory_order_seq_cst);
+                for (size_t i = 0; i < BP_BUFFER_SLOTS; i++)
+                    while (slots[old][i].readers.load(std::memory_order_acquire) != 0)
+                        std::this_thread::yield();
+            }
+        }
+
+        //每个槽独占一个缓存行
+        struct alignas(64) slot_t
+        {
+            std::atomic<int> readers;
+        };
+
+        Compare compare;
+        std::atomic<list_t *> active;
+        std::atomic<list_t *> frozen;
+        std::atomic<uint64_t> seq;
+        std::atomic<int> epoch;
+        mutable slot_t slots[2][BP_BUFFER_SLOTS];
+    };
+}
+#endif
@@ -0,0 +1,226 @@
+#include "../include/buffer_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+
+namespace BPT
+{
+    buffer_pool::buffer_pool(const page_io *io, size_t capacity)
+        : io(io), capacity(capacity), frames(capacity),
+          shards(std::min(capacity, (size_t)BP_CACHE_SHARDS))
+    {
+        assert(capacity > 0);
+        //所有页面放在一块按页对齐的内存中
+        void *memory = NULL;
+        if (posix_memalign(&memory, BP_PAGE_SIZE, capacity * BP_PAGE_SIZE) != 0)
+            abort();
+        for (size_t i = 0; i < capacity; i++)
+        {
+            frames[i].data = (char *)memory + i * BP_PAGE_SIZE;
+            shards[i % shards.size()].free_frames.push_back(&frames[i]);
+        }
+    }
+
+    buffer_pool::~buffer_pool()
+    {
+        free(frames[0].data);
+    }
+
+    int buffer_pool::read(void *block, off_t offset, size_t size)
+    {
+        char *dst = (char *)block;
+        while (size > 0)
+        {
+            off_t page = offset - offset % BP_PAGE_SIZE;
+            size_t in = offset - page;
+            size_t n = std::min(size, (size_t)BP_PAGE_SIZE - in);
+
+            shard_t &shard = shard_of(page);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            frame_t *frame = fetch(shard, page);
+            //读取超出文件末尾的内容视为出错
+            if (frame == NULL || in + n > frame->valid)
+                return -1;
+            memcpy(dst, frame->data + in, n);
+
+            dst += n;
+            offset += n;
+            size -= n;
+        }
+        return 0;
+    }
+
+    int buffer_pool::write(const void *block, off_t offset, size_t size)
+    {
+        const char *src = (const char *)block;
+        while (size > 0)
+        {
+            off_t page = offset - offset % BP_PAGE_SIZE;
+            size_t in = offset - page;
+            size_t n = std::min(size, (size_t)BP_PAGE_SIZE - in);
+
+            shard_t &shard = shard_of(page);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            frame_t *frame = fetch(shard, page);
+            if (frame == NULL)
+                return -1;
+            memcpy(frame->data + in, src, n);
+            frame->dirty = true;
+            frame->valid = std::max(frame->valid, in + n);
+
+            src += n;
+            offset += n;
+            size -= n;
+        }
+        return 0;
+    }
+
+    char *buffer_pool::pin(off_t page)
+    {
+        assert(page % BP_PAGE_SIZE == 0);
+        shard_t &shard = shard_of(page);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        frame_t *frame = fetch(shard, page);
+        if (frame == NULL)
+            return NULL;
+        frame->pin++;
+        return frame->data;
+    }
+
+    void buffer_pool::unpin(off_t page, bool dirty)
+    {
+        shard_t &shard = shard_of(page);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        std::unordered_map<off_t, frame_t *>::iterator it = shard.table.find(page);
+        assert(it != shard.table.end() && it->second->pin > 0);
+        frame_t *frame = it->second;
+        frame->pin--;
+        if (dirty)
+        {
+            //无法得知调用者修改的范围，整页写回
+            frame->dirty = true;
+            frame->valid = BP_PAGE_SIZE;
+        }
+    }
+
+    int buffer_pool::flush()
+    {
+        int ret = 0;
+        for (size_t i = 0; i < shards.size(); i++)
+        {
+            shard_t &shard = shards[i];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (std::list<frame_t *>::iterator it = shard.lru.begin(); it != shard.lru.end(); ++it)
+                if ((*it)->dirty && write_back(*it) != 0)
+                    ret = -1;
+        }
+        return ret;
+    }
+
+    void buffer_pool::reset()
+    {
+        for (size_t i = 0; i < shards.size(); i++)
+        {
+            shard_t &shard = shards[i];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (std::list<frame_t *>::iterator it = shard.lru.begin(); it != shard.lru.end(); ++it)
+            {
+                assert((*it)->pin == 0);
+                shard.free_frames.push_back(*it);
+            }
+            shard.lru.clear();
+            shard.table.clear();
+        }
+    }
+
+    size_t buffer_pool::hits() const
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < shards.size(); i++)
+        {
+            std::lock_guard<std::mutex> lock(shards[i].mutex);
+            n += shards[i].hits;
+        }
+        return n;
+    }
+
+    size_t buffer_pool::misses() const
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < shards.size(); i++)
+        {
+            std::lock_guard<std::mutex> lock(shards[i].mutex);
+            n += shards[i].misses;
+        }
+        return n;
+    }
+
+    buffer_pool::frame_t *buffer_pool::fetch(shard_t &shard, off_t page)
+    {
+        std::unordered_map<off_t, frame_t *>::iterator it = shard.table.find(page);
+        if (it != shard.table.end())
+        {
+            ++shard.hits;
+            frame_t *frame = it->second;
+            shard.lru.splice(shard.lru.begin(), shard.lru, frame->lru);
+            return frame;
+        }
+
+        ++shard.misses;
+        frame_t *frame = victim(shard);
+        if (frame == NULL)
+            return NULL;
+
+        ssize_t rd = io->read_page(frame->data, page, BP_PAGE_SIZE);
+        if (rd < 0)
+        {
+            shard.free_frames.push_back(frame);
+            return NULL;
+        }
+        //文件末尾之后的部分填0
+        memset(frame->data + rd, 0, BP_PAGE_SIZE - rd);
+        frame->page = page;
+        frame->valid = rd;
+        frame->pin = 0;
+        frame->dirty = false;
+        shard.lru.push_front(frame);
+        frame->lru = shard.lru.begin();
+        shard.table[page] = frame;
+        return frame;
+    }
+
+    buffer_pool::frame_t *buffer_pool::victim(shard_t &shard)
+    {
+        if (!shard.free_frames.empty())
+        {
+            frame_t *frame = shard.free_frames.back();
+            shard.free_frames.pop_back();
+            return frame;
+        }
+
+        //从表尾开始寻找最久未使用且未被固定的页面
+        for (std::list<frame_t *>::reverse_iterator it = shard.lru.rbegin(); it != shard.lru.rend(); ++it)
+        {
+            frame_t *frame = *it;
+            if (frame->pin > 0)
+                continue;
+            if (frame->dirty && write_back(frame) != 0)
+                return NULL;
+            shard.table.erase(frame->page);
+            shard.lru.erase(frame->lru);
+            return frame;
+        }
+        //所有页面都被固定
+        return NULL;
+    }
+
+    int buffer_pool::write_back(frame_t *frame)
+    {
+        ssize_t wd = io->write_page(frame->data, frame->page, frame->valid);
+        if (wd != (ssize_t)frame->valid)
+            return -1;
+        frame->dirty = false;
+        return 0;
+    }
+}
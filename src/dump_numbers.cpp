@@ -5,6 +5,25 @@
 #include <time.h>
 #include <iostream>
 #include <algorithm>
+#include <chrono>
+
+//以整数作为key，不再需要把数字格式化成字符串
+typedef BPT::basic_bpt<int64_t, BPT::value_t> number_bpt;
+
+//依次产生(i, i)的输入迭代器，批量建树时不必先把所有数据放进内存
+struct number_iterator
+{
+    int i;
+    explicit number_iterator(int i) : i(i) {}
+    std::pair<int64_t, BPT::value_t> operator*() const { return std::make_pair((int64_t)i, i); }
+    number_iterator &operator++()
+    {
+        ++i;
+        return *this;
+    }
+    bool operator!=(const number_iterator &other) const { return i != other.i; }
+};
+
 int main(int argc, char *argv[])
 {
     clock_t start_time, end_time;
@@ -17,21 +36,45 @@ int main(int argc, char *argv[])
     if (argc > 3)
         end = atoi(argv[3]);
 
-    if (argc != 4 || start >= end)
+    bool bulk = argc > 4 && strcmp(argv[4], "bulk") == 0;
+    bool parallel = argc > 4 && strcmp(argv[4], "parallel") == 0;
+
+    if (argc < 4 || argc > 5 || (argc == 5 && !bulk && !parallel) || start >= end)
     {
-        fprintf(stderr, "usage: %s database [start] [end] \n", argv[0]);
+        fprintf(stderr, "usage: %s database [start] [end] [bulk|parallel]\n", argv[0]);
         return 1;
     }
+    //使用4KB大小的结点
+    BPT::options_t options;
+    options.page_size = 4096;
+    if (bulk)
+    {
+        //有序数据直接自底向上建树
+        start_time = clock();
+        number_bpt database(argv[1], true, options);
+        database.bulk_load(number_iterator(start), number_iterator(end + 1));
+        end_time = clock();
+        std::cout << "批量建树运行时间" << (double)(end_time - start_time) / CLOCKS_PER_SEC << std::endl;
+        return 0;
+    }
+    if (parallel)
+    {
+        //多线程排序并建树，clock()统计的是所有线程的CPU时间，这里用墙上时间
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        number_bpt database(argv[1], true, options);
+        database.bulk_load_parallel(number_iterator(start), number_iterator(end + 1));
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+        std::cout << "并行建树运行时间" << elapsed.count() << std::endl;
+        return 0;
+    }
     {
         start_time = clock();
-        BPT::bpt database(argv[1], true);
+        number_bpt database(argv[1], true, options);
         for (int i = start; i <= end; i++)
         {
             if (i % 10000 == 0)
                 printf("%d\n", i);
-            char key[16] = {0};
-            sprintf(key, "%d", i);
-            database.insert(key, i);
+            database.insert(i, i);
         }
         printf("%d\n", end);
         end_time = clock();
@@ -46,14 +89,12 @@ int main(int argc, char *argv[])
         }
         std::random_shuffle(array, array + length);
         start_time = clock();
-        BPT::bpt database(argv[1], true);
+        number_bpt database(argv[1], true, options);
         for (i = 0; i <= length - 1; i++)
         {
             if (i  % 10000 == 0)
                 printf("%d\n", i);
-            char key[16] = {0};
-            sprintf(key, "%d", array[i]);
-            database.insert(key, array[i]);
+            database.insert(array[i], array[i]);
         }
         printf("%d\n", end);
         end_time = clock();
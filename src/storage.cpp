@@ -0,0 +1,292 @@
+#include "../include/storage.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <algorithm>
+
+namespace BPT
+{
+    file_t::file_t() : fd(-1), direct(false)
+    {
+    }
+
+    file_t::~file_t()
+    {
+        close();
+    }
+
+    int file_t::open(const char *path, bool direct)
+    {
+        close();
+        this->direct = false;
+#ifdef O_DIRECT
+        if (direct)
+        {
+            fd = ::open(path, O_RDWR | O_CREAT | O_DIRECT, 0644);
+            //文件系统不支持O_DIRECT时退回普通读写
+            if (fd >= 0)
+            {
+                this->direct = true;
+                return 0;
+            }
+        }
+#endif
+        fd = ::open(path, O_RDWR | O_CREAT, 0644);
+        return fd >= 0 ? 0 : -1;
+    }
+
+    void file_t::close()
+    {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+    }
+
+    int file_t::truncate()
+    {
+        return ftruncate(fd, 0);
+    }
+
+    off_t file_t::size() const
+    {
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+            return -1;
+        return st.st_size;
+    }
+
+    int file_t::sync() const
+    {
+        return fdatasync(fd);
+    }
+
+    int file_t::advise(off_t offset, size_t size) const
+    {
+        if (direct)
+            return 0;
+        return posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED) == 0 ? 0 : -1;
+    }
+
+    ssize_t file_t::read_page(void *page, off_t offset, size_t size) const
+    {
+        size_t done = 0;
+        while (done < size)
+        {
+            ssize_t rd = pread(fd, (char *)page + done, size - done, offset + done);
+            if (rd < 0 && errno == EINTR)
+                continue;
+            if (rd < 0)
+                return -1;
+            //到达文件末尾
+            if (rd == 0)
+                break;
+            done += rd;
+        }
+        return done;
+    }
+
+    ssize_t file_t::write_page(const void *page, off_t offset, size_t size) const
+    {
+        //O_DIRECT要求整页写入，页缓存保证有效数据之后的部分为0
+        size_t length = size;
+        if (direct)
+            length = (size + BP_PAGE_SIZE - 1) / BP_PAGE_SIZE * BP_PAGE_SIZE;
+
+        size_t done = 0;
+        while (done < length)
+        {
+            ssize_t wd = pwrite(fd, (const char *)page + done, length - done, offset + done);
+            if (wd < 0 && errno == EINTR)
+                continue;
+            if (wd <= 0)
+                return -1;
+            done += wd;
+        }
+        return size;
+    }
+
+    mapping_t::mapping_t() : base(NULL), length(0), reserved(0), file(NULL)
+    {
+    }
+
+    mapping_t::~mapping_t()
+    {
+        unmap();
+    }
+
+    int mapping_t::map(const file_t *file)
+    {
+        unmap();
+        this->file = file;
+
+        off_t size = file->size();
+        if (size < 0)
+            return -1;
+        //扩展时从文件末尾开始映射新增的部分，要求长度按页对齐
+        off_t aligned = (std::max(size, (off_t)BP_MMAP_MIN_SIZE) + BP_PAGE_SIZE - 1) /
+                        BP_PAGE_SIZE * BP_PAGE_SIZE;
+        if (aligned != size && ftruncate(file->fd, aligned) != 0)
+            return -1;
+        size = aligned;
+
+        void *area = mmap(NULL, BP_MMAP_RESERVE, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        void *addr;
+        if (area != MAP_FAILED && (size_t)size <= BP_MMAP_RESERVE)
+        {
+            addr = mmap(area, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, file->fd, 0);
+            if (addr == MAP_FAILED)
+            {
+                munmap(area, BP_MMAP_RESERVE);
+                return -1;
+            }
+            reserved = BP_MMAP_RESERVE;
+        }
+        else
+        {
+            if (area != MAP_FAILED)
+                munmap(area, BP_MMAP_RESERVE);
+            addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+            if (addr == MAP_FAILED)
+                return -1;
+            reserved = 0;
+        }
+        base = (char *)addr;
+        length = size;
+        return 0;
+    }
+
+    int mapping_t::map_anonymous()
+    {
+        unmap();
+        this->file = NULL;
+
+        //预留的地址空间不可访问，扩展时再开放读写
+        void *area = mmap(NULL, BP_MMAP_RESERVE, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (area != MAP_FAILED)
+        {
+            if (mprotect(area, BP_MMAP_MIN_SIZE, PROT_READ | PROT_WRITE) != 0)
+            {
+                munmap(area, BP_MMAP_RESERVE);
+                return -1;
+            }
+            reserved = BP_MMAP_RESERVE;
+        }
+        else
+        {
+            area = mmap(NULL, BP_MMAP_MIN_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (area == MAP_FAILED)
+                return -1;
+            reserved = 0;
+        }
+        base = (char *)area;
+        length = BP_MMAP_MIN_SIZE;
+        return 0;
+    }
+
+    void mapping_t::unmap()
+    {
+        if (base != NULL)
+            munmap(base, reserved != 0 ? reserved : length.load());
+        base = NULL;
+        length = 0;
+        reserved = 0;
+    }
+
+    int mapping_t::grow(off_t size)
+    {
+        if ((size_t)size <= length)
+            return 0;
+        //按倍数扩展，避免每分配一个结点就重新映射一次
+        size_t old_length = length;
+        size_t new_length = std::max(old_length * 2, (size_t)size);
+        new_length = (new_length + BP_PAGE_SIZE - 1) / BP_PAGE_SIZE * BP_PAGE_SIZE;
+        if (reserved != 0)
+        {
+            //预留的地址空间用完之后不能再扩展
+            if ((size_t)size > reserved)
+                return -1;
+            new_length = std::min(new_length, reserved);
+        }
+        if (file != NULL && ftruncate(file->fd, new_length) != 0)
+            return -1;
+        if (reserved != 0 && file == NULL)
+        {
+            if (mprotect(base + old_length, new_length - old_length, PROT_READ | PROT_WRITE) != 0)
+                return -1;
+        }
+        else if (reserved != 0)
+        {
+            void *addr = mmap(base + old_length, new_length - old_length, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_FIXED, file->fd, old_length);
+            if (addr == MAP_FAILED)
+                return -1;
+        }
+        else
+        {
+            void *addr = mremap(base, old_length, new_length, MREMAP_MAYMOVE);
+            if (addr == MAP_FAILED)
+                return -1;
+            base = (char *)addr;
+        }
+        length = new_length;
+        return 0;
+    }
+
+    int mapping_t::advise(off_t offset, size_t size) const
+    {
+        if (base == NULL || (size_t)offset >= length)
+            return -1;
+        //madvise要求起始地址按页对齐
+        off_t begin = offset - offset % BP_PAGE_SIZE;
+        size_t end = std::min(length.load(), (size_t)offset + size);
+        return madvise(base + begin, end - begin, MADV_WILLNEED);
+    }
+
+    int mapping_t::sync() const
+    {
+        if (base == NULL || file == NULL)
+            return 0;
+        return msync(base, length.load(), MS_SYNC);
+    }
+
+    //按8字节对齐的字逐个写入，对映射的访问都是relaxed原子操作，与load_words相同
+    static void store_words(char *dst, const void *src, size_t size)
+    {
+        const char *s = (const char *)src;
+        for (; size > 0 && (uintptr_t)dst % sizeof(uint64_t) != 0; size--)
+            __atomic_store_n(dst++, *s++, __ATOMIC_RELAXED);
+        for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t))
+        {
+            uint64_t word;
+            memcpy(&word, s, sizeof(uint64_t));
+            __atomic_store_n((uint64_t *)dst, word, __ATOMIC_RELAXED);
+            dst += sizeof(uint64_t);
+            s += sizeof(uint64_t);
+        }
+        for (; size > 0; size--)
+            __atomic_store_n(dst++, *s++, __ATOMIC_RELAXED);
+    }
+
+    int mapping_t::read(void *block, off_t offset, size_t size) const
+    {
+        if (base == NULL || offset + size > length)
+            return -1;
+        memcpy(block, base + offset, size);
+        return 0;
+    }
+
+    int mapping_t::write(const void *block, off_t offset, size_t size)
+    {
+        if (base == NULL || grow(offset + size) != 0)
+            return -1;
+        //不加锁的读者可能同时读取这里，见load_words
+        store_words(base + offset, block, size);
+        return 0;
+    }
+}
@@ -1,13 +1,64 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <algorithm>
+#include <list>
+#include <map>
+#include <vector>
+#include <thread>
 
 #define PRINT(a) fprintf(stderr, "\033[33m%s\033[0m \033[32m%s\033[0m\n", a, "Passed")
 
 #include "../include/bpt.h"
 using BPT::bpt;
+typedef BPT::basic_bpt<int64_t, int64_t> int_bpt;
+
+//复制文件并丢掉末尾的cut个字节，用于模拟崩溃时磁盘上的内容
+static void copy_file(const char *from, const char *to, long cut = 0)
+{
+    FILE *in = fopen(from, "rb");
+    FILE *out = fopen(to, "wb");
+    assert(in != NULL && out != NULL);
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in) - cut;
+    fseek(in, 0, SEEK_SET);
+    char buf[4096];
+    while (size > 0)
+    {
+        size_t n = fread(buf, 1, std::min(size, (long)sizeof(buf)), in);
+        assert(n > 0);
+        fwrite(buf, 1, n, out);
+        size -= n;
+    }
+    fclose(in);
+    fclose(out);
+}
+
+//与默认顺序相同的比较函数，结点内的查找记下调用次数，用于检查查找是否经过key_search
+struct counted_compare : BPT::key_compare<int64_t>
+{
+};
+namespace BPT
+{
+    template <>
+    struct key_search<int64_t, counted_compare>
+    {
+        static size_t calls;
+        static size_t lower_bound(const int64_t *keys, size_t n, int64_t key)
+        {
+            calls++;
+            return key_search<int64_t, key_compare<int64_t> >::lower_bound(keys, n, key);
+        }
+        static size_t upper_bound(const int64_t *keys, size_t n, int64_t key)
+        {
+            calls++;
+            return key_search<int64_t, key_compare<int64_t> >::upper_bound(keys, n, key);
+        }
+    };
+    size_t key_search<int64_t, counted_compare>::calls = 0;
+}
 
 int main(int argc, char *argv[])
 {
@@ -52,10 +103,10 @@ int main(int argc, char *argv[])
         BPT::leaf_node_t leaf;
         tree.read(&leaf, tree.search_leaf("t1"));
         assert(leaf.n == 4);
-        assert(BPT::keycmp_ut(leaf.children[0].key, "t1") == 0);
-        assert(BPT::keycmp_ut(leaf.children[1].key, "t2") == 0);
-        assert(BPT::keycmp_ut(leaf.children[2].key, "t3") == 0);
-        assert(BPT::keycmp_ut(leaf.children[3].key, "t4") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[0], "t1") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[1], "t2") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[2], "t3") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[3], "t4") == 0);
         BPT::value_t value;
         assert(tree.search("t1", &value) == 0);
         assert(value == 1);
@@ -87,25 +138,25 @@ int main(int argc, char *argv[])
         off_t index_off = tree.search_index("t1");
         tree.read(&index, index_off);
         assert(index.n == 2);
-        assert(index.parent == 0);
-        assert(BPT::keycmp_ut(index.children[0].key, "t4") == 0);
+        assert(index_off == tree.meta.root_offset);
+        assert(BPT::keycmp_ut(index.keys[0], "t4") == 0);
 
         BPT::leaf_node_t leaf1, leaf2;
         off_t leaf1_off = tree.search_leaf("t1");
-        assert(leaf1_off == index.children[0].child);
+        assert(leaf1_off == index.children()[0]);
         tree.read(&leaf1, leaf1_off);
         assert(leaf1.n == 3);
-        assert(BPT::keycmp_ut(leaf1.children[0].key, "t1") == 0);
-        assert(BPT::keycmp_ut(leaf1.children[1].key, "t2") == 0);
-        assert(BPT::keycmp_ut(leaf1.children[2].key, "t3") == 0);
+        assert(BPT::keycmp_ut(leaf1.keys[0], "t1") == 0);
+        assert(BPT::keycmp_ut(leaf1.keys[1], "t2") == 0);
+        assert(BPT::keycmp_ut(leaf1.keys[2], "t3") == 0);
 
         off_t leaf2_off = tree.search_leaf("t4");
         assert(leaf1.next == leaf2_off);
-        assert(leaf2_off == index.children[1].child);
+        assert(leaf2_off == index.children()[1]);
         tree.read(&leaf2, leaf2_off);
         assert(leaf2.n == 2);
-        assert(BPT::keycmp_ut(leaf2.children[0].key, "t4") == 0);
-        assert(BPT::keycmp_ut(leaf2.children[1].key, "t5") == 0);
+        assert(BPT::keycmp_ut(leaf2.keys[0], "t4") == 0);
+        assert(BPT::keycmp_ut(leaf2.keys[1], "t5") == 0);
 
         PRINT("SplitLeafBy2");
     }
@@ -149,9 +200,9 @@ int main(int argc, char *argv[])
         off_t index_off = tree.search_index("t8");
         tree.read(&index, index_off);
         assert(index.n == 3);
-        assert(index.parent == 0);
-        assert(BPT::keycmp_ut(index.children[0].key, "t4") == 0);
-        assert(BPT::keycmp_ut(index.children[1].key, "t7") == 0);
+        assert(index_off == tree.meta.root_offset);
+        assert(BPT::keycmp_ut(index.keys[0], "t4") == 0);
+        assert(BPT::keycmp_ut(index.keys[1], "t7") == 0);
 
         BPT::leaf_node_t leaf1, leaf2, leaf3;
         off_t leaf1_off = tree.search_leaf("t3");
@@ -160,9 +211,9 @@ int main(int argc, char *argv[])
         tree.read(&leaf1, leaf1_off);
         tree.read(&leaf2, leaf2_off);
         tree.read(&leaf3, leaf3_off);
-        assert(index.children[0].child == leaf1_off);
-        assert(index.children[1].child == leaf2_off);
-        assert(index.children[2].child == leaf3_off);
+        assert(index.children()[0] == leaf1_off);
+        assert(index.children()[1] == leaf2_off);
+        assert(index.children()[2] == leaf3_off);
         assert(leaf1.next == leaf2_off);
         assert(leaf2.next == leaf3_off);
         assert(leaf3.next == 0);
@@ -203,14 +254,14 @@ int main(int argc, char *argv[])
         tree.read(&node1, node1_off);
         tree.read(&node2, node2_off);
         assert(root.n == 2);
-        assert(root.children[0].child == node1_off);
-        assert(root.children[1].child == node2_off);
-        assert(BPT::keycmp_ut(root.children[0].key, "t09") == 0);
+        assert(root.children()[0] == node1_off);
+        assert(root.children()[1] == node2_off);
+        assert(BPT::keycmp_ut(root.keys[0], "t09") == 0);
         assert(node1.n == 3);
-        assert(BPT::keycmp_ut(node1.children[0].key, "t03") == 0);
-        assert(BPT::keycmp_ut(node1.children[1].key, "t06") == 0);
+        assert(BPT::keycmp_ut(node1.keys[0], "t03") == 0);
+        assert(BPT::keycmp_ut(node1.keys[1], "t06") == 0);
         assert(node2.n == 2);
-        assert(BPT::keycmp_ut(node2.children[0].key, "t12") == 0);
+        assert(BPT::keycmp_ut(node2.keys[0], "t12") == 0);
 
         BPT::value_t value;
         for (int i = 0; i < 10; i++)
@@ -449,18 +500,18 @@ int main(int argc, char *argv[])
         BPT::leaf_node_t leaf;
         tree.read(&leaf, tree.meta.leaf_offset);
         assert(leaf.n == 3);
-        assert(BPT::keycmp_ut(leaf.children[0].key, "t1") == 0);
-        assert(BPT::keycmp_ut(leaf.children[1].key, "t2") == 0);
-        assert(BPT::keycmp_ut(leaf.children[2].key, "t4") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[0], "t1") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[1], "t2") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[2], "t4") == 0);
         assert(tree.remove("t1") == 0);
         tree.read(&leaf, tree.meta.leaf_offset);
         assert(leaf.n == 2);
-        assert(BPT::keycmp_ut(leaf.children[0].key, "t2") == 0);
-        assert(BPT::keycmp_ut(leaf.children[1].key, "t4") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[0], "t2") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[1], "t4") == 0);
         assert(tree.remove("t2") == 0);
         tree.read(&leaf, tree.meta.leaf_offset);
         assert(leaf.n == 1);
-        assert(BPT::keycmp_ut(leaf.children[0].key, "t4") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[0], "t4") == 0);
         assert(tree.remove("t4") == 0);
         tree.read(&leaf, tree.meta.leaf_offset);
         assert(leaf.n == 0);
@@ -489,43 +540,43 @@ int main(int argc, char *argv[])
         // | 3 6  |
         // | 0 1 2 | 3 4 5 | 6 7 8 9 |
         tree.read(&node, tree.meta.root_offset);
-        assert(BPT::keycmp_ut(node.children[0].key, "03") == 0);
-        assert(BPT::keycmp_ut(node.children[1].key, "06") == 0);
+        assert(BPT::keycmp_ut(node.keys[0], "03") == 0);
+        assert(BPT::keycmp_ut(node.keys[1], "06") == 0);
         assert(tree.remove("03") == 0);
         assert(tree.remove("04") == 0);
         // | 2 6  |
         // | 0 1 | 2 5 | 6 7 8 9 |
         tree.read(&node, tree.meta.root_offset);
-        assert(BPT::keycmp_ut(node.children[0].key, "02") == 0);
-        assert(BPT::keycmp_ut(node.children[1].key, "06") == 0);
+        assert(BPT::keycmp_ut(node.keys[0], "02") == 0);
+        assert(BPT::keycmp_ut(node.keys[1], "06") == 0);
         tree.read(&leaf, tree.search_leaf("00"));
-        assert(leaf.parent == tree.meta.root_offset);
+        assert(tree.search_index("00") == tree.meta.root_offset);
         assert(leaf.n == 2);
-        assert(BPT::keycmp_ut(leaf.children[0].key, "00") == 0);
-        assert(BPT::keycmp_ut(leaf.children[1].key, "01") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[0], "00") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[1], "01") == 0);
         tree.read(&leaf, tree.search_leaf("05"));
-        assert(leaf.parent == tree.meta.root_offset);
+        assert(tree.search_index("05") == tree.meta.root_offset);
         assert(leaf.n == 2);
-        assert(BPT::keycmp_ut(leaf.children[0].key, "02") == 0);
-        assert(BPT::keycmp_ut(leaf.children[1].key, "05") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[0], "02") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[1], "05") == 0);
         assert(tree.remove("05") == 0);
         // | 2 7  |
         // | 0 1 | 2 6 | 7 8 9 |
         tree.read(&node, tree.meta.root_offset);
         assert(node.n == 3);
-        assert(BPT::keycmp_ut(node.children[0].key, "02") == 0);
-        assert(BPT::keycmp_ut(node.children[1].key, "07") == 0);
+        assert(BPT::keycmp_ut(node.keys[0], "02") == 0);
+        assert(BPT::keycmp_ut(node.keys[1], "07") == 0);
         tree.read(&leaf, tree.search_leaf("04"));
-        assert(leaf.parent == tree.meta.root_offset);
+        assert(tree.search_index("04") == tree.meta.root_offset);
         assert(leaf.n == 2);
-        assert(BPT::keycmp_ut(leaf.children[0].key, "02") == 0);
-        assert(BPT::keycmp_ut(leaf.children[1].key, "06") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[0], "02") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[1], "06") == 0);
         tree.read(&leaf, tree.search_leaf("07"));
-        assert(leaf.parent == tree.meta.root_offset);
+        assert(tree.search_index("07") == tree.meta.root_offset);
         assert(leaf.n == 3);
-        assert(BPT::keycmp_ut(leaf.children[0].key, "07") == 0);
-        assert(BPT::keycmp_ut(leaf.children[1].key, "08") == 0);
-        assert(BPT::keycmp_ut(leaf.children[2].key, "09") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[0], "07") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[1], "08") == 0);
+        assert(BPT::keycmp_ut(leaf.keys[2], "09") == 0);
 
         BPT::value_t value;
         assert(tree.search("00", &value) == 0);
@@ -548,6 +599,1464 @@ int main(int argc, char *argv[])
 
         PRINT("RemoveWithBorrow");
     }
+
+    {
+        //缓存只有一页时，脏页会在换出时写回
+        BPT::options_t options;
+        options.cache_pages = 1;
+        bpt tree("test.db", true, options);
+        for (int i = 0; i < size; i++)
+        {
+            char key[8] = {0};
+            sprintf(key, "%d", i);
+            assert(tree.insert(key, i) == 0);
+        }
+        assert(tree.cache.misses() > 2);
+    }
+
+    {
+        bpt tree("test.db");
+        BPT::value_t value;
+        for (int i = 0; i < size; i++)
+        {
+            char key[8] = {0};
+            sprintf(key, "%d", i);
+            assert(tree.search(key, &value) == 0);
+            assert(value == i);
+        }
+        //整棵树已在缓存中，再次查找不会访问磁盘
+        size_t misses = tree.cache.misses();
+        for (int i = 0; i < size; i++)
+        {
+            char key[8] = {0};
+            sprintf(key, "%d", i);
+            assert(tree.search(key, &value) == 0);
+        }
+        assert(tree.cache.misses() == misses);
+        PRINT("BufferPool");
+    }
+
+    {
+        BPT::options_t options;
+        options.direct_io = true;
+        options.cache_pages = 1;
+        bpt tree("test.db", true, options);
+        for (int i = 0; i < size; i++)
+        {
+            char key[8] = {0};
+            sprintf(key, "%d", i);
+            assert(tree.insert(key, i) == 0);
+        }
+    }
+
+    {
+        bpt tree("test.db");
+        assert(tree.file.direct == false);
+        for (int i = 0; i < size; i++)
+        {
+            char key[8] = {0};
+            sprintf(key, "%d", i);
+            BPT::value_t value;
+            assert(tree.search(key, &value) == 0);
+            assert(value == i);
+        }
+        PRINT("DirectIO");
+    }
+
+    {
+        BPT::options_t options;
+        options.mode = BPT::STORAGE_MMAP;
+        bpt tree("test.db", true, options);
+        for (int i = 0; i < size * 8; i++)
+        {
+            char key[8] = {0};
+            sprintf(key, "%04d", i);
+            assert(tree.insert(key, i) == 0);
+        }
+    }
+
+    {
+        //映射模式写入的文件可以用页缓存模式读取，反之亦然
+        bpt cached("test.db");
+        BPT::options_t options;
+        options.mode = BPT::STORAGE_MMAP;
+        bpt mapped("test.db", false, options);
+        assert(mapped.meta.slot == cached.meta.slot);
+        for (int i = 0; i < size * 8; i++)
+        {
+            char key[8] = {0};
+            sprintf(key, "%04d", i);
+            BPT::value_t value;
+            assert(mapped.search(key, &value) == 0);
+            assert(value == i);
+        }
+        BPT::key_t left("0010");
+        BPT::value_t values[16];
+        assert(mapped.search_range(&left, "0025", values, 16) == 16);
+        for (int i = 0; i < 16; i++)
+            assert(values[i] == i + 10);
+        PRINT("MmapStorage");
+    }
+    for (int i = 0; i < 10; i++)
+    {
+        for (int j = 0; j < size; j++)
+            numbers[j] = j;
+        std::random_shuffle(numbers, numbers + size);
+        bpt tree("test.db", true);
+        for (int j = 0; j < size; j++)
+        {
+            char key[8] = {0};
+            sprintf(key, "%d", numbers[j]);
+            assert(tree.insert(key, numbers[j]) == 0);
+        }
+
+        //删除一半，剩下的key仍然可以找到
+        std::random_shuffle(numbers, numbers + size);
+        for (int j = 0; j < size / 2; j++)
+        {
+            char key[8] = {0};
+            sprintf(key, "%d", numbers[j]);
+            assert(tree.remove(key) == 0);
+        }
+        for (int j = 0; j < size; j++)
+        {
+            char key[8] = {0};
+            sprintf(key, "%d", numbers[j]);
+            BPT::value_t value;
+            if (j < size / 2)
+                assert(tree.search(key, &value) != 0);
+            else
+                assert(tree.search(key, &value) == 0 && value == numbers[j]);
+        }
+    }
+
+    PRINT("RemoveManyKeysRandom");
+
+    {
+        bpt tree("test.db", true);
+        off_t slot = 0;
+        for (int round = 0; round < 3; round++)
+        {
+            for (int i = 0; i < size; i++)
+            {
+                char key[8] = {0};
+                sprintf(key, "%d", i);
+                assert(tree.insert(key, i) == 0);
+            }
+            for (int i = 0; i < size; i++)
+            {
+                char key[8] = {0};
+                sprintf(key, "%d", i);
+                assert(tree.remove(key) == 0);
+            }
+            assert(tree.meta.leaf_node_num == 1);
+            assert(tree.meta.internal_node_num == 1);
+            //第一轮之后，被删除的结点会被重新使用，文件不再增长
+            if (round == 0)
+                slot = tree.meta.slot;
+            else
+                assert(tree.meta.slot == slot);
+        }
+        PRINT("ReuseFreedNodes");
+    }
+    {
+        BPT::options_t options;
+        options.page_size = 4096;
+        bpt tree("test.db", true, options);
+        assert(tree.meta.order == bpt::order_of_page(4096));
+        for (int i = 0; i < size * 16; i++)
+        {
+            char key[8] = {0};
+            sprintf(key, "%d", i);
+            assert(tree.insert(key, i) == 0);
+        }
+        assert(tree.meta.height == 1);
+    }
+
+    {
+        //打开已有文件时阶数以文件中记录的为准
+        bpt tree("test.db");
+        assert(tree.meta.order == bpt::order_of_page(4096));
+        for (int i = 0; i < size * 16; i++)
+        {
+            char key[8] = {0};
+            sprintf(key, "%d", i);
+            BPT::value_t value;
+            assert(tree.search(key, &value) == 0);
+            assert(value == i);
+        }
+        for (int i = 0; i < size * 16; i += 2)
+        {
+            char key[8] = {0};
+            sprintf(key, "%d", i);
+            assert(tree.remove(key) == 0);
+        }
+        for (int i = 0; i < size * 16; i++)
+        {
+            char key[8] = {0};
+            sprintf(key, "%d", i);
+            BPT::value_t value;
+            assert((tree.search(key, &value) == 0) == (i % 2 == 1));
+        }
+        PRINT("PageSizedNodes");
+    }
+    for (int i = 0; i < size; i++)
+        numbers[i] = i;
+    std::random_shuffle(numbers, numbers + size);
+    {
+        BPT::options_t options;
+        options.page_size = 256;
+        int_bpt tree("test.db", true, options);
+        assert(tree.meta.key_size == sizeof(int64_t));
+        assert(tree.meta.order == int_bpt::order_of_page(256));
+        for (int i = 0; i < size; i++)
+            assert(tree.insert((int64_t)numbers[i] << 32, -numbers[i]) == 0);
+    }
+
+    {
+        int_bpt tree("test.db");
+        int64_t value;
+        for (int i = 0; i < size; i++)
+        {
+            assert(tree.search((int64_t)i << 32, &value) == 0);
+            assert(value == -i);
+            assert(tree.search(((int64_t)i << 32) + 1, &value) != 0);
+        }
+
+        int64_t left = (int64_t)10 << 32;
+        int64_t values[16];
+        assert(tree.search_range(&left, (int64_t)25 << 32, values, 16) == 16);
+        for (int i = 0; i < 16; i++)
+            assert(values[i] == -(i + 10));
+
+        for (int i = 0; i < size; i += 2)
+            assert(tree.remove((int64_t)i << 32) == 0);
+        for (int i = 0; i < size; i++)
+            assert((tree.search((int64_t)i << 32, &value) == 0) == (i % 2 == 1));
+        PRINT("Int64Keys");
+    }
+
+    {
+        BPT::options_t options;
+        options.page_size = 256;
+        //覆盖最后一个叶子结点需要合并、平分以及不需要处理的各种情况
+        for (int n = 0; n <= size * 4; n += 7)
+        {
+            const double fills[] = {0.5, 0.7, 1.0};
+            for (int f = 0; f < 3; f++)
+            {
+                std::vector<std::pair<int64_t, int64_t> > records;
+                for (int i = 0; i < n; i++)
+                    records.push_back(std::make_pair((int64_t)i * 2, (int64_t)i));
+                int_bpt tree("test.db", true, options);
+                assert(tree.bulk_load(records.begin(), records.end(), fills[f]) == 0);
+
+                //叶子结点链表按顺序串起所有数据，且每个结点都不低于下限
+                int_bpt::leaf_node_t leaf;
+                off_t offset = tree.meta.leaf_offset, prev = 0;
+                int count = 0, leafs = 0;
+                while (offset != 0)
+                {
+                    tree.read(&leaf, offset);
+                    assert(leaf.prev == prev);
+                    assert(leafs == 0 || leaf.n >= tree.meta.order / 2);
+                    for (size_t i = 0; i < leaf.n; i++)
+                        assert(leaf.keys[i] == (int64_t)count++ * 2);
+                    prev = offset;
+                    offset = leaf.next;
+                    leafs++;
+                }
+                assert(count == n);
+                assert((size_t)leafs == tree.meta.leaf_node_num);
+
+                int64_t value;
+                for (int i = 0; i < n; i++)
+                {
+                    assert(tree.search(i * 2, &value) == 0);
+                    assert(value == i);
+                    assert(tree.search(i * 2 + 1, &value) != 0);
+                }
+                //建树之后仍可以正常插入和删除
+                for (int i = 0; i < n; i++)
+                    assert(tree.insert(i * 2 + 1, -i) == 0);
+                for (int i = 0; i < n; i += 2)
+                    assert(tree.remove(i * 2) == 0);
+                for (int i = 0; i < n; i++)
+                {
+                    assert((tree.search(i * 2, &value) == 0) == (i % 2 == 1));
+                    assert(tree.search(i * 2 + 1, &value) == 0);
+                    assert(value == -i);
+                }
+            }
+        }
+
+        std::vector<int_bpt::record_t> records(size);
+        for (int i = 0; i < size; i++)
+        {
+            records[i].key = i;
+            records[i].value = i;
+        }
+        int_bpt tree("test.db", true, options);
+        assert(tree.bulk_load(records.begin(), records.end()) == 0);
+        assert(tree.meta.leaf_node_num > 1);
+        //输入无序时失败，并留下一棵空树
+        std::swap(records[10], records[11]);
+        assert(tree.bulk_load(records.begin(), records.end()) != 0);
+        assert(tree.meta.leaf_node_num == 1);
+        int64_t value;
+        assert(tree.search(0, &value) != 0);
+        assert(tree.insert(0, 0) == 0);
+        PRINT("BulkLoad");
+    }
+
+    {
+        //并行建树：输入无序且有重复的key，保留最先出现的一个
+        const int n = 60000;
+        std::vector<std::pair<int64_t, int64_t> > records;
+        std::map<int64_t, int64_t> expect;
+        for (int i = 0; i < n; i++)
+        {
+            int64_t key = rand() % (n * 2);
+            records.push_back(std::make_pair(key, (int64_t)i));
+            expect.insert(std::make_pair(key, (int64_t)i));
+        }
+        size_t threads[] = {1, 3, 8};
+        for (int mode = 0; mode < 2; mode++)
+            for (int t = 0; t < 3; t++)
+            {
+                BPT::options_t options;
+                options.page_size = 256;
+                options.mode = mode == 0 ? BPT::STORAGE_CACHE : BPT::STORAGE_MMAP;
+                int_bpt tree("test.db", true, options);
+                assert(tree.insert(-1, -1) == 0);
+                assert(tree.bulk_load_parallel(records.begin(), records.end(), threads[t]) == 0);
+
+                //叶子结点链表按顺序串起所有数据
+                int_bpt::leaf_node_t leaf;
+                off_t offset = tree.meta.leaf_offset, prev = 0;
+                std::map<int64_t, int64_t>::const_iterator it = expect.begin();
+                size_t leafs = 0;
+                while (offset != 0)
+                {
+                    tree.read(&leaf, offset);
+                    assert(leaf.prev == prev);
+                    assert(offset == tree.meta.leaf_offset || leaf.n >= tree.meta.order / 2);
+                    for (size_t i = 0; i < leaf.n; i++, ++it)
+                        assert(leaf.keys[i] == it->first && leaf.values()[i] == it->second);
+                    prev = offset;
+                    offset = leaf.next;
+                    leafs++;
+                }
+                assert(it == expect.end() && leafs == tree.meta.leaf_node_num);
+
+                int64_t value;
+                assert(tree.search(-1, &value) != 0);
+                for (it = expect.begin(); it != expect.end(); ++it)
+                    assert(tree.search(it->first, &value) == 0 && value == it->second);
+
+                //与有序输入的串行建树得到相同的结构
+                std::vector<std::pair<int64_t, int64_t> > sorted(expect.begin(), expect.end());
+                BPT::meta_t parallel = tree.meta;
+                assert(tree.bulk_load(sorted.begin(), sorted.end()) == 0);
+                assert(tree.meta.height == parallel.height && tree.meta.slot == parallel.slot &&
+                       tree.meta.leaf_node_num == parallel.leaf_node_num &&
+                       tree.meta.internal_node_num == parallel.internal_node_num &&
+                       tree.meta.root_offset == parallel.root_offset);
+            }
+
+        //非随机访问的输入和空输入
+        std::list<std::pair<int64_t, int64_t> > list(records.begin(), records.begin() + 100);
+        int_bpt tree("test.db", true);
+        assert(tree.bulk_load_parallel(list.begin(), list.end(), 4) == 0);
+        int64_t value;
+        for (std::list<std::pair<int64_t, int64_t> >::const_iterator i = list.begin(); i != list.end(); ++i)
+            assert(tree.search(i->first, &value) == 0);
+        assert(tree.bulk_load_parallel(list.end(), list.end()) == 0);
+        assert(tree.meta.leaf_node_num == 1 && tree.search(records[0].first, &value) != 0);
+        assert(tree.insert(1, 1) == 0);
+    }
+    PRINT("ParallelBulkLoad");
+
+    {
+        BPT::options_t options;
+        options.page_size = 256;
+        int_bpt tree("test.db", true, options);
+        //一批数据全部落在同一个叶子结点时一次分裂成多个结点
+        std::vector<std::pair<int64_t, int64_t> > batch;
+        for (int i = 0; i < size * 4; i++)
+            batch.push_back(std::make_pair((int64_t)numbers[i % size] * 4 + i / size, (int64_t)i));
+        assert(tree.insert_batch(batch.begin(), batch.begin() + size) == size);
+        //已存在的key和批内重复的key被跳过
+        batch.push_back(batch[size]);
+        batch.push_back(batch[0]);
+        assert(tree.insert_batch(batch.begin() + size, batch.end()) == size * 3);
+
+        int64_t value;
+        for (int i = 0; i < size * 4; i++)
+        {
+            assert(tree.search(batch[i].first, &value) == 0);
+            assert(value == i);
+        }
+        int_bpt::leaf_node_t leaf;
+        off_t offset = tree.meta.leaf_offset, prev = 0;
+        int64_t count = 0;
+        while (offset != 0)
+        {
+            tree.read(&leaf, offset);
+            assert(leaf.prev == prev);
+            assert(offset == tree.meta.leaf_offset || leaf.n >= tree.meta.order / 2);
+            for (size_t i = 0; i < leaf.n; i++)
+                assert(leaf.keys[i] == count++);
+            prev = offset;
+            offset = leaf.next;
+        }
+        assert(count == size * 4);
+        for (int i = 0; i < size * 4; i += 2)
+            assert(tree.remove(batch[i].first) == 0);
+        for (int i = 0; i < size * 4; i++)
+            assert((tree.search(batch[i].first, &value) == 0) == (i % 2 == 1));
+        PRINT("InsertBatch");
+    }
+
+    {
+        int_bpt tree("test.db");
+        //无序、重复以及不存在的key混在一起
+        std::vector<int64_t> keys;
+        for (int i = 0; i < size * 6; i++)
+            keys.push_back(numbers[i % size] * 5 % (size * 5));
+        std::vector<int64_t> values(keys.size());
+        std::vector<int> status(keys.size());
+        int found = tree.search_batch(keys.data(), keys.size(), values.data(), status.data());
+        int expect = 0;
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            int64_t value;
+            bool exist = tree.search(keys[i], &value) == 0;
+            assert((status[i] == 0) == exist);
+            if (exist)
+            {
+                assert(values[i] == value);
+                ++expect;
+            }
+        }
+        assert(found == expect && found > 0 && found < (int)keys.size());
+        assert(tree.search_batch(NULL, 0, NULL, NULL) == 0);
+        PRINT("SearchBatch");
+    }
+
+    {
+        BPT::options_t options;
+        options.page_size = 256;
+        int_bpt tree("test.db", true, options);
+        //保存0到size*4-1之间的奇数
+        for (int i = 0; i < size * 2; i++)
+            assert(tree.insert(numbers[i % size] * 4 + i / size * 2 + 1, i) == 0);
+        int_bpt::cursor cursor(tree);
+        int64_t expect = 1;
+        for (cursor.seek_first(); cursor.valid(); cursor.next(), expect += 2)
+            assert(cursor.key() == expect);
+        assert(expect == size * 4 + 1);
+        assert(!cursor.next());
+
+        expect = size * 4 - 1;
+        for (cursor.seek_last(); cursor.valid(); cursor.prev(), expect -= 2)
+            assert(cursor.key() == expect);
+        assert(expect == -1);
+
+        //seek定位到第一个不小于key的位置，seek_for_prev定位到最后一个不大于key的位置
+        assert(cursor.seek(10) && cursor.key() == 11);
+        assert(cursor.seek(11) && cursor.key() == 11);
+        assert(cursor.prev() && cursor.key() == 9);
+        assert(cursor.next() && cursor.next() && cursor.key() == 13);
+        assert(cursor.seek_for_prev(10) && cursor.key() == 9);
+        assert(cursor.seek_for_prev(9) && cursor.key() == 9);
+        assert(!cursor.seek(size * 4));
+        assert(cursor.seek_for_prev(size * 4) && cursor.key() == size * 4 - 1);
+        assert(!cursor.seek_for_prev(0));
+        assert(cursor.seek(-5) && cursor.key() == 1);
+
+        int_bpt empty("test.db", true);
+        int_bpt::cursor none(empty);
+        assert(!none.seek_first() && !none.seek_last() && !none.seek(0));
+        PRINT("Cursor");
+    }
+
+    {
+        BPT::options_t options;
+        options.page_size = 256;
+        int_bpt tree("test.db", true, options);
+        std::vector<std::pair<int64_t, int64_t> > records;
+        for (int i = 0; i < size * 16; i++)
+            records.push_back(std::make_pair((int64_t)i, (int64_t)i));
+        //批量建立的叶子结点在文件中连续存放
+        assert(tree.bulk_load(records.begin(), records.end()) == 0);
+
+        off_t leaf_size = tree.size_of((int_bpt::leaf_node_t *)NULL);
+        BPT::readahead_t ra;
+        off_t leaf = tree.meta.leaf_offset;
+        tree.read_ahead(ra, leaf + leaf_size, true);
+        assert(ra.depth == 0);
+        //连续访问时预读深度加倍直至上限
+        for (int i = 2; i < 40; i++)
+        {
+            tree.read_ahead(ra, leaf + i * leaf_size, true);
+            assert(ra.depth >= BP_READAHEAD_MIN && ra.depth <= BP_READAHEAD_MAX);
+            assert(ra.edge > leaf + i * leaf_size);
+        }
+        assert(ra.depth == BP_READAHEAD_MAX);
+        //跳跃访问时停止预读
+        tree.read_ahead(ra, leaf, true);
+        assert(ra.depth == 0 && ra.edge == 0);
+        //逆序扫描时向文件头部方向预读
+        tree.read_ahead(ra, leaf + leaf_size * 20, false);
+        tree.read_ahead(ra, leaf + leaf_size * 19, false);
+        assert(ra.depth == BP_READAHEAD_MIN);
+        assert(ra.edge == leaf + leaf_size * (20 - BP_READAHEAD_MIN));
+
+        //预读不影响扫描结果
+        int64_t values[size * 16];
+        int64_t left = 0;
+        assert(tree.search_range(&left, size * 16, values, size * 16) == size * 16);
+        for (int i = 0; i < size * 16; i++)
+            assert(values[i] == i);
+        int_bpt::cursor cursor(tree);
+        int64_t expect = size * 16 - 1;
+        for (cursor.seek_last(); cursor.valid(); cursor.prev())
+            assert(cursor.key() == expect--);
+        assert(expect == -1);
+        PRINT("ReadAhead");
+    }
+
+    for (int round = 0; round < 4; round++)
+    {
+        BPT::options_t options;
+        options.page_size = 256;
+        options.wal = round == 0 ? BPT::WAL_GROUP : round == 1 ? BPT::WAL_SYNC : BPT::WAL_ASYNC;
+        if (round == 1 || round == 3)
+            options.mode = BPT::STORAGE_MMAP;
+        {
+            int_bpt tree("test.db", true, options);
+            for (int i = 0; i < size; i++)
+                assert(tree.insert(numbers[i], i) == 0);
+            for (int i = 0; i < size; i += 2)
+                assert(tree.remove(numbers[i]) == 0);
+            assert(tree.update(numbers[1], -1) == 0);
+            tree.wal.sync();
+            assert(tree.wal.size() > 0);
+
+            //在析构做检查点之前复制文件，相当于进程在此时崩溃
+            copy_file("test.db", "crash.db");
+            copy_file("test.db.wal", "crash.db.wal");
+            //最后一条日志记录只写入了一部分
+            copy_file("test.db", "torn.db");
+            copy_file("test.db.wal", "torn.db.wal", 100);
+        }
+
+        {
+            int_bpt tree("crash.db", false, options);
+            int64_t value;
+            for (int i = 0; i < size; i++)
+            {
+                assert((tree.search(numbers[i], &value) == 0) == (i % 2 == 1));
+                if (i % 2 == 1)
+                    assert(value == (i == 1 ? -1 : i));
+            }
+        }
+        {
+            //不再使用日志时重做之后删除日志文件
+            int_bpt tree("torn.db");
+            assert(access("torn.db.wal", F_OK) != 0);
+            int64_t value;
+            for (int i = 0; i < size; i++)
+            {
+                assert((tree.search(numbers[i], &value) == 0) == (i % 2 == 1));
+                if (i % 2 == 1)
+                    assert(value == i);
+            }
+            assert(tree.insert(numbers[0], 0) == 0);
+        }
+        unlink("crash.db");
+        unlink("crash.db.wal");
+        unlink("torn.db");
+    }
+    unlink("test.db.wal");
+    PRINT("WriteAheadLog");
+
+    for (int round = 0; round < 2; round++)
+    {
+        BPT::options_t options;
+        options.page_size = 256;
+        options.shadow_paging = true;
+        if (round == 1)
+            options.mode = BPT::STORAGE_MMAP;
+        off_t newest;
+        {
+            int_bpt tree("test.db", true, options);
+            for (int i = 0; i < size; i++)
+                assert(tree.insert(numbers[i], i) == 0);
+            for (int i = 0; i < size; i += 2)
+                assert(tree.remove(numbers[i]) == 0);
+            assert(tree.update(numbers[1], -1) == 0);
+            assert(tree.meta.generation > (uint64_t)size);
+            assert(tree.meta.shadow_pages > 0);
+            newest = tree.meta.generation % 2 ? sizeof(BPT::meta_t) : 0;
+            //每次修改都已提交，此时崩溃不丢失任何修改
+            copy_file("test.db", "crash.db");
+            copy_file("test.db", "torn.db");
+        }
+        {
+            int_bpt tree("crash.db", false, options);
+            int64_t value;
+            for (int i = 0; i < size; i++)
+            {
+                assert((tree.search(numbers[i], &value) == 0) == (i % 2 == 1));
+                if (i % 2 == 1)
+                    assert(value == (i == 1 ? -1 : i));
+            }
+        }
+        if (round == 0)
+        {
+            //最新的元数据没有写完整时退回上一次提交。关闭时的检查点又提交了一次，
+            //使用关闭之前的文件
+            copy_file("torn.db", "crash.db");
+            FILE *f = fopen("crash.db", "r+b");
+            fseek(f, newest + offsetof(BPT::meta_t, slot), SEEK_SET);
+            fputc(0x5a, f);
+            fclose(f);
+        }
+        {
+            //不再使用影子分页时只使用第一份元数据
+            int_bpt tree("crash.db");
+            assert(tree.meta.generation == 0);
+            int64_t value;
+            for (int i = 0; i < size; i++)
+            {
+                assert((tree.search(numbers[i], &value) == 0) == (i % 2 == 1));
+                if (i % 2 == 1)
+                    assert(value == (i == 1 && round == 1 ? -1 : i));
+            }
+            assert(tree.insert(numbers[0], 0) == 0);
+        }
+        {
+            int_bpt tree("crash.db");
+            int64_t value;
+            assert(tree.search(numbers[0], &value) == 0);
+        }
+        unlink("crash.db");
+        unlink("torn.db");
+    }
+    {
+        //影子分页不打开日志，新建之后的检查点同样能清除影子页，重新打开时不再写回旧的影子页
+        BPT::options_t options;
+        options.page_size = 256;
+        options.shadow_paging = true;
+        {
+            int_bpt tree("test.db", true, options);
+            for (int i = 0; i < size; i++)
+                assert(tree.insert(numbers[i], i) == 0);
+            assert(tree.make_checkpoint() == 0 && tree.meta.shadow_pages == 0);
+            for (int i = 0; i < size; i += 2)
+                assert(tree.remove(numbers[i]) == 0);
+        }
+        int_bpt tree("test.db", false, options);
+        assert(tree.meta.shadow_pages == 0);
+        int64_t value;
+        for (int i = 0; i < size; i++)
+            assert((tree.search(numbers[i], &value) == 0) == (i % 2 == 1));
+    }
+    for (int round = 0; round < 2; round++)
+    {
+        //批量插入使影子区多次重新分配，每次提交之后崩溃都能恢复出已提交的全部数据
+        BPT::options_t options;
+        options.page_size = 256;
+        options.shadow_paging = true;
+        if (round == 1)
+            options.mode = BPT::STORAGE_MMAP;
+        std::map<int64_t, int64_t> expect;
+        int_bpt tree("test.db", true, options);
+        for (int batch = 1; batch <= 30; batch++)
+        {
+            std::vector<std::pair<int64_t, int64_t> > records;
+            for (int i = 0; i < batch * 8; i++)
+                records.push_back(std::make_pair((int64_t)(rand() % (size * 64)), (int64_t)batch));
+            tree.insert_batch(records.begin(), records.end());
+            expect.insert(records.begin(), records.end());
+            copy_file("test.db", "crash.db");
+            int_bpt crash("crash.db", false, options);
+            for (std::map<int64_t, int64_t>::iterator it = expect.begin(); it != expect.end(); ++it)
+            {
+                int64_t value;
+                assert(crash.search(it->first, &value) == 0 && value == it->second);
+            }
+        }
+        //影子区按页对齐，原来的影子区改作空闲的叶子结点
+        for (int area = 0; area < 2; area++)
+            assert(tree.meta.shadow_area[area] % BP_PAGE_SIZE == 0);
+        assert(tree.meta.free_leaf != 0);
+        unlink("crash.db");
+    }
+    PRINT("ShadowPaging");
+
+    for (int round = 0; round < 3; round++)
+    {
+        BPT::options_t options;
+        options.page_size = 256;
+        options.cache_pages = 16;
+        if (round == 1)
+            options.mode = BPT::STORAGE_MMAP;
+        if (round == 2)
+            options.wal = BPT::WAL_GROUP;
+        int_bpt tree("test.db", true, options);
+        //查找线程只访问预先插入的偶数，修改线程插入并删除各自范围内的奇数
+        const int threads = 4, per_thread = size * 2;
+        for (int i = 0; i < threads * per_thread; i += 2)
+            assert(tree.insert(i, i) == 0);
+
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++)
+        {
+            workers.push_back(std::thread([&tree, t, per_thread]() {
+                for (int i = t * per_thread + 1; i < (t + 1) * per_thread; i += 2)
+                    assert(tree.insert(i, -i) == 0);
+                for (int i = t * per_thread + 1; i < (t + 1) * per_thread; i += 4)
+                    assert(tree.remove(i) == 0);
+            }));
+            workers.push_back(std::thread([&tree, t, per_thread, threads]() {
+                int64_t value;
+                for (int round = 0; round < 4; round++)
+                    for (int i = 0; i < threads * per_thread; i += 2)
+                    {
+                        assert(tree.search(i, &value) == 0);
+                        assert(value == i);
+                    }
+                int_bpt::cursor cursor(tree);
+                int64_t last = -1;
+                for (cursor.seek_first(); cursor.valid(); cursor.next())
+                {
+                    assert(cursor.key() > last);
+                    last = cursor.key();
+                }
+            }));
+        }
+        for (size_t t = 0; t < workers.size(); t++)
+            workers[t].join();
+
+        int64_t value;
+        for (int i = 0; i < threads * per_thread; i++)
+        {
+            bool exist = i % 2 == 0 || i % 4 == 3;
+            assert((tree.search(i, &value) == 0) == exist);
+            if (exist)
+                assert(value == (i % 2 == 0 ? i : -i));
+        }
+    }
+    {
+        //游标读完一个叶子结点之后，它的兄弟结点被合并回收，又被分配给key更小的结点：
+        //游标重新定位，读到的key仍然严格递增
+        BPT::options_t options;
+        options.order = 4;
+        int_bpt tree("test.db", true, options);
+        for (int i = 0; i < 40; i++)
+            assert(tree.insert(i * 10, i) == 0);
+        int_bpt::cursor cursor(tree);
+        assert(cursor.seek(0));
+        int64_t last = cursor.key();
+        for (int i = 4; i < 40; i++)
+            assert(tree.remove(i * 10) == 0);
+        assert(tree.meta.free_leaf != 0);
+        for (int i = 1; i < 40; i++)
+            assert(tree.insert(-i, i) == 0);
+        int count = 0;
+        for (cursor.next(); cursor.valid(); cursor.next(), count++)
+        {
+            assert(cursor.key() > last);
+            last = cursor.key();
+        }
+        assert(count == 3 && last == 30);
+    }
+    unlink("test.db.wal");
+    PRINT("Concurrency");
+
+    for (int round = 0; round < 3; round++)
+    {
+        //第三轮的结点较大，不加锁的查找在映射中先二分查找再顺序比较
+        BPT::options_t options;
+        options.page_size = round == 2 ? 4096 : 256;
+        if (round >= 1)
+            options.mode = BPT::STORAGE_MMAP;
+        int_bpt tree("test.db", true, options);
+        //偶数的值始终是该数加上mod的倍数，奇数被反复插入删除，结点不断分裂合并
+        const int64_t n = size * 8, mod = 1 << 20;
+        for (int64_t i = 0; i < n; i += 2)
+            assert(tree.insert(i, i) == 0);
+
+        std::vector<std::thread> workers;
+        workers.push_back(std::thread([&tree, n, mod]() {
+            for (int64_t r = 1; r <= 3; r++)
+            {
+                for (int64_t i = 1; i < n; i += 2)
+                    assert(tree.insert(i, i) == 0);
+                for (int64_t i = 0; i < n; i += 2)
+                    assert(tree.update(i, i + r * mod) == 0);
+                for (int64_t i = 1; i < n; i += 2)
+                    assert(tree.remove(i) == 0);
+            }
+        }));
+        for (int t = 0; t < 4; t++)
+            workers.push_back(std::thread([&tree, n, mod]() {
+                int64_t value;
+                for (int r = 0; r < 4; r++)
+                    for (int64_t i = 0; i < n; i += 2)
+                    {
+                        assert(tree.search(i, &value) == 0);
+                        assert(value % mod == i);
+                    }
+            }));
+        for (size_t t = 0; t < workers.size(); t++)
+            workers[t].join();
+
+        //所有修改结束后页面都已解锁，发布的根结点与元数据一致
+        for (size_t i = 0; i < BP_VERSION_SLOTS; i++)
+            assert(tree.versions[i] % 2 == 0);
+        assert(tree.root_offset == tree.meta.root_offset);
+        assert(tree.root_height == tree.meta.height);
+        int64_t value;
+        for (int64_t i = 0; i < n; i++)
+        {
+            assert((tree.search(i, &value) == 0) == (i % 2 == 0));
+            if (i % 2 == 0)
+                assert(value == i + 3 * mod);
+        }
+
+        //批量建树之后查找看到的是新的B+树
+        std::vector<std::pair<int64_t, int64_t> > records;
+        for (int64_t i = 0; i < n; i += 3)
+            records.push_back(std::make_pair(i, -i));
+        assert(tree.bulk_load(records.begin(), records.end()) == 0);
+        for (int64_t i = 0; i < n; i++)
+        {
+            assert((tree.search(i, &value) == 0) == (i % 3 == 0));
+            if (i % 3 == 0)
+                assert(value == -i);
+        }
+    }
+    PRINT("OptimisticRead");
+
+    {
+        BPT::options_t options;
+        options.page_size = 256;
+        options.buffer_size = 64;
+        std::map<int64_t, int64_t> expect;
+        {
+            int_bpt tree("test.db", true, options);
+            //随机的插入、更新、删除，返回值与直接修改B+树时一致
+            srand(7);
+            for (int i = 0; i < size * 40; i++)
+            {
+                int64_t key = rand() % (size * 4), value = rand();
+                switch (rand() % 3)
+                {
+                case 0:
+                    assert(tree.insert(key, value) == (expect.count(key) ? 1 : 0));
+                    expect.insert(std::make_pair(key, value));
+                    break;
+                case 1:
+                    if (expect.count(key))
+                    {
+                        assert(tree.update(key, value) == 0);
+                        expect[key] = value;
+                    }
+                    else
+                        assert(tree.update(key, value) != 0);
+                    break;
+                default:
+                    assert(tree.remove(key) == (expect.erase(key) ? 0 : -1));
+                }
+                if (i % 97 == 0)
+                {
+                    //查找同时看到写缓冲和B+树中的数据
+                    int64_t value;
+                    for (int64_t k = 0; k < size * 4; k++)
+                    {
+                        assert((tree.search(k, &value) == 0) == (expect.count(k) == 1));
+                        if (expect.count(k))
+                            assert(value == expect[k]);
+                    }
+                    int64_t left = size, right = size * 3, values[16];
+                    std::map<int64_t, int64_t>::iterator it = expect.lower_bound(left);
+                    bool next = true;
+                    while (next)
+                    {
+                        int n = tree.search_range(&left, right, values, 16, &next);
+                        for (int j = 0; j < n; j++, ++it)
+                            assert(values[j] == it->second);
+                        if (next)
+                            assert(left == it->first);
+                    }
+                    assert(it == expect.upper_bound(right));
+
+                    std::vector<int64_t> keys, found(size);
+                    std::vector<int> status(size);
+                    for (int64_t k = 0; k < size; k++)
+                        keys.push_back(rand() % (size * 4));
+                    tree.search_batch(keys.data(), size, found.data(), status.data());
+                    for (int k = 0; k < size; k++)
+                        assert((status[k] == 0) == (expect.count(keys[k]) == 1));
+                }
+            }
+            //合并之后B+树本身包含所有修改
+            tree.drain();
+            int_bpt::cursor cursor(tree);
+            std::map<int64_t, int64_t>::iterator it = expect.begin();
+            for (cursor.seek_first(); cursor.valid(); cursor.next(), ++it)
+                assert(cursor.key() == it->first && cursor.value() == it->second);
+            assert(it == expect.end());
+            assert(tree.get_meta().leaf_node_num > 1);
+        }
+        //析构时合并写缓冲，重新打开后数据仍在
+        {
+            int_bpt tree("test.db", false, options);
+            int64_t value;
+            for (int64_t k = 0; k < size * 4; k++)
+            {
+                assert((tree.search(k, &value) == 0) == (expect.count(k) == 1));
+                if (expect.count(k))
+                    assert(value == expect[k]);
+            }
+        }
+
+        //并发修改不同范围的key，同时查找预先插入的key
+        int_bpt tree("test.db", true, options);
+        const int threads = 4, per_thread = size * 4;
+        for (int i = 0; i < threads * per_thread; i += 2)
+            assert(tree.insert(i, i) == 0);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++)
+        {
+            workers.push_back(std::thread([&tree, t, per_thread]() {
+                for (int i = t * per_thread + 1; i < (t + 1) * per_thread; i += 2)
+                    assert(tree.insert(i, -i) == 0);
+                for (int i = t * per_thread + 1; i < (t + 1) * per_thread; i += 4)
+                    assert(tree.remove(i) == 0);
+            }));
+            workers.push_back(std::thread([&tree, threads, per_thread]() {
+                int64_t value;
+                for (int round = 0; round < 4; round++)
+                    for (int i = 0; i < threads * per_thread; i += 2)
+                    {
+                        assert(tree.search(i, &value) == 0);
+                        assert(value == i);
+                    }
+            }));
+        }
+        for (size_t t = 0; t < workers.size(); t++)
+            workers[t].join();
+        int64_t value;
+        for (int i = 0; i < threads * per_thread; i++)
+        {
+            bool exist = i % 2 == 0 || i % 4 == 3;
+            assert((tree.search(i, &value) == 0) == exist);
+            if (exist)
+                assert(value == (i % 2 == 0 ? i : -i));
+        }
+    }
+    PRINT("WriteBuffer");
+
+    {
+        //结点内查找与std::lower_bound、std::upper_bound的结果相同，
+        //整数key覆盖SIMD比较的整段部分、剩余部分以及取值的两端
+        std::vector<int64_t> i64;
+        std::vector<uint32_t> u32;
+        std::vector<int32_t> i32;
+        std::vector<BPT::key_t> strs;
+        for (int n = 0; n < 200; n += 7)
+        {
+            i64.clear(), u32.clear(), i32.clear(), strs.clear();
+            for (int i = 0; i < n; i++)
+            {
+                i64.push_back((int64_t)(((uint64_t)rand() << 40) - ((uint64_t)1 << 61) * (i % 3)));
+                u32.push_back((uint32_t)rand() * 3);
+                i32.push_back(rand() - RAND_MAX / 2);
+                char str[16];
+                sprintf(str, "%d", rand() % 1000);
+                strs.push_back(str);
+            }
+            if (n > 2)
+            {
+                i64[0] = INT64_MIN, i64[1] = INT64_MAX;
+                u32[0] = 0, u32[1] = UINT32_MAX;
+                i32[0] = INT32_MIN, i32[1] = INT32_MAX;
+            }
+            std::sort(i64.begin(), i64.end());
+            std::sort(u32.begin(), u32.end());
+            std::sort(i32.begin(), i32.end());
+            std::sort(strs.begin(), strs.end(), [](const BPT::key_t &a, const BPT::key_t &b)
+                      { return BPT::keycmp(a, b) < 0; });
+            for (int probe = 0; probe < n + 2; probe++)
+            {
+                int64_t a = probe < n ? (int64_t)((uint64_t)i64[probe] + (probe & 1)) : probe == n ? INT64_MIN : INT64_MAX;
+                uint32_t b = probe < n ? u32[probe] - (probe & 1) : probe == n ? 0 : UINT32_MAX;
+                int32_t c = probe < n ? i32[probe] : probe == n ? INT32_MIN : INT32_MAX;
+                BPT::key_t d = probe < n ? strs[probe] : BPT::key_t(probe == n ? "" : "9999");
+                typedef BPT::key_search<int64_t, BPT::key_compare<int64_t> > s64;
+                typedef BPT::key_search<uint32_t, BPT::key_compare<uint32_t> > su32;
+                typedef BPT::key_search<int32_t, BPT::key_compare<int32_t> > s32;
+                typedef BPT::key_search<BPT::key_t, BPT::key_compare<BPT::key_t> > sstr;
+                assert(s64::lower_bound(i64.data(), n, a) == (size_t)(std::lower_bound(i64.begin(), i64.end(), a) - i64.begin()));
+                assert(s64::upper_bound(i64.data(), n, a) == (size_t)(std::upper_bound(i64.begin(), i64.end(), a) - i64.begin()));
+                assert(su32::lower_bound(u32.data(), n, b) == (size_t)(std::lower_bound(u32.begin(), u32.end(), b) - u32.begin()));
+                assert(su32::upper_bound(u32.data(), n, b) == (size_t)(std::upper_bound(u32.begin(), u32.end(), b) - u32.begin()));
+                assert(s32::lower_bound(i32.data(), n, c) == (size_t)(std::lower_bound(i32.begin(), i32.end(), c) - i32.begin()));
+                assert(s32::upper_bound(i32.data(), n, c) == (size_t)(std::upper_bound(i32.begin(), i32.end(), c) - i32.begin()));
+                size_t lower = 0, upper = 0;
+                while (lower < (size_t)n && BPT::keycmp(strs[lower], d) < 0)
+                    ++lower;
+                while (upper < (size_t)n && BPT::keycmp(strs[upper], d) <= 0)
+                    ++upper;
+                assert(sstr::lower_bound(strs.data(), n, d) == lower);
+                assert(sstr::upper_bound(strs.data(), n, d) == upper);
+            }
+        }
+
+        //先比较长度再按字节比较，0字节之后残留的内容不影响结果
+        BPT::key_t x("abc"), y("abd"), z("ab");
+        assert(BPT::keycmp(x, y) < 0 && BPT::keycmp(y, x) > 0 && BPT::keycmp(z, x) < 0);
+        BPT::key_t w("abcdefg");
+        strcpy(w.k, "abc");
+        assert(BPT::keycmp(w, x) == 0);
+        BPT::key_t high("a\xff"), low("a\x01");
+        assert(BPT::keycmp(low, high) < 0);
+        BPT::key_t full;
+        memset(full.k, 'z', sizeof(full.k));
+        assert(BPT::keycmp(full, BPT::key_t("zzzzzzzzzzzzzzz")) > 0);
+
+        //结点头部记录阶数，映射模式下不论阶数是否等于结点容量都直接访问映射中的结点
+        typedef BPT::basic_bpt<int64_t, int64_t, BPT::key_compare<int64_t>, 4096> page_bpt;
+        for (int round = 0; round < 2; round++)
+        {
+            BPT::options_t options;
+            options.mode = BPT::STORAGE_MMAP;
+            options.page_size = round == 0 ? 4096 : 1024;
+            {
+                page_bpt tree("test.db", true, options);
+                assert((tree.meta.order == page_bpt::leaf_node_t::capacity) == (round == 0));
+                for (int i = 0; i < size * 64; i++)
+                    assert(tree.insert((int64_t)i * 7919 % (size * 64), i) == 0);
+                for (int i = 0; i < size * 64; i += 3)
+                    assert(tree.remove(i) == 0);
+            }
+            page_bpt tree("test.db", false, options);
+            for (int i = 0; i < size * 64; i++)
+            {
+                int64_t value;
+                assert((tree.search(i, &value) == 0) == (i % 3 != 0));
+            }
+            int64_t values[size * 64];
+            int64_t left = 0;
+            assert(tree.search_range(&left, size * 64, values, size * 64) == size * 64 - (size * 64 + 2) / 3);
+            tree.reset_copy_stats();
+            assert(tree.insert(1, 0) == 1 && tree.remove(3) == -1);
+            assert(tree.copy_stats().bytes_read == 0);
+        }
+    }
+    PRINT("KeySearch");
+
+    {
+        int value;
+        {
+            bpt tree("test.db", true);
+            assert(tree.meta.format == BP_FORMAT_VERSION);
+            assert(tree.insert("k1", 1) == 0);
+        }
+        {
+            bpt tree("test.db");
+            assert(tree.search("k1", &value) == 0 && value == 1);
+            //模拟其他版本的程序写入的文件
+            tree.meta.format = BP_FORMAT_VERSION - 1;
+            tree.write(&tree.meta, OFFSET_META);
+        }
+        //格式不兼容的文件被重新初始化
+        bpt tree("test.db");
+        assert(tree.meta.format == BP_FORMAT_VERSION);
+        assert(tree.search("k1", &value) != 0);
+        PRINT("FormatVersion");
+    }
+
+    {
+        //8字节的字符串key：规范化编码的顺序与keycmp一致，结点内可以容纳更多的key
+        typedef BPT::basic_key_t<8> short_key_t;
+        typedef BPT::basic_bpt<short_key_t, int> short_bpt;
+        assert(sizeof(short_key_t) == 8);
+        assert(short_bpt::order_of_page(4096) > bpt::order_of_page(4096));
+        std::vector<short_key_t> keys;
+        for (int i = 0; i < 2000; i++)
+        {
+            short_key_t key;
+            int len = rand() % 8;
+            for (int j = 0; j < len; j++)
+                key.k[j] = "ab\x01\x7f\x80\xff"[rand() % 6];
+            keys.push_back(key);
+        }
+        for (size_t i = 0; i + 1 < keys.size(); i++)
+        {
+            const short_key_t &a = keys[i], &b = keys[i + 1];
+            size_t la = strnlen(a.k, 8), lb = strnlen(b.k, 8);
+            int expect = la != lb ? (la < lb ? -1 : 1) : memcmp(a.k, b.k, la);
+            int c = BPT::keycmp(a, b);
+            assert((c < 0) == (expect < 0) && (c == 0) == (expect == 0));
+        }
+        //超长的字符串不截断，保留的前缀不以0结尾，比所有能存入的key都大
+        short_key_t fits("abcdefg"), too_long("abcdefghij");
+        assert(!fits.too_long() && too_long.too_long());
+        assert(memcmp(too_long.k, "abcdefgh", 8) == 0);
+        assert(BPT::keycmp(fits, too_long) < 0);
+
+        auto less = [](const short_key_t &a, const short_key_t &b)
+        { return BPT::keycmp(a, b) < 0; };
+        std::map<short_key_t, int, decltype(less)> expect(less);
+        {
+            short_bpt tree("test.db", true);
+            for (size_t i = 0; i < keys.size(); i++)
+            {
+                int ret = tree.insert(keys[i], i);
+                assert((ret == 0) == expect.insert(std::make_pair(keys[i], (int)i)).second);
+            }
+            for (size_t i = 0; i < keys.size(); i += 5)
+                assert((tree.remove(keys[i]) == 0) == (expect.erase(keys[i]) == 1));
+        }
+        short_bpt tree("test.db");
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            int value;
+            auto it = expect.find(keys[i]);
+            assert((tree.search(keys[i], &value) == 0) == (it != expect.end()));
+            assert(it == expect.end() || value == it->second);
+        }
+        //范围查询按keycmp的顺序返回
+        std::vector<int> values(expect.size() + 1);
+        short_key_t left, right;
+        memset(right.k, 0xff, sizeof(right.k));
+        size_t count = tree.search_range(&left, right, values.data(), values.size());
+        assert(count == expect.size());
+        size_t i = 0;
+        for (auto it = expect.begin(); it != expect.end(); ++it, ++i)
+            assert(values[i] == it->second);
+        //超长的key作为上界时不限制范围，修改操作被拒绝，B+树不变
+        left = short_key_t();
+        assert(tree.search_range(&left, too_long, values.data(), values.size()) == (int)count);
+        int value;
+        assert(tree.insert(too_long, 1) == -1 && tree.search(too_long, &value) != 0);
+        assert(tree.insert("abcdefgh", 1) == -1 && tree.search(fits, &value) != 0);
+        assert(tree.update(too_long, 1) == -1 && tree.remove(too_long) == -1);
+        std::pair<short_key_t, int> batch[] = {{fits, 1}, {too_long, 2}};
+        assert(tree.insert_batch(batch, batch + 2) == -1 && tree.search(fits, &value) != 0);
+        assert(tree.bulk_load_parallel(batch, batch + 2) == -1);
+        left = short_key_t();
+        assert(tree.search_range(&left, too_long, values.data(), values.size()) == (int)count);
+
+        //直接比较key_search与逐个比较的结果
+        std::vector<short_key_t> sorted;
+        for (auto it = expect.begin(); it != expect.end(); ++it)
+            sorted.push_back(it->first);
+        typedef BPT::key_search<short_key_t, BPT::key_compare<short_key_t> > sshort;
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            size_t n = i % (sorted.size() + 1);
+            size_t lower = std::lower_bound(sorted.begin(), sorted.begin() + n, keys[i], less) - sorted.begin();
+            size_t upper = std::upper_bound(sorted.begin(), sorted.begin() + n, keys[i], less) - sorted.begin();
+            assert(sshort::lower_bound(sorted.data(), n, keys[i]) == lower);
+            assert(sshort::upper_bound(sorted.data(), n, keys[i]) == upper);
+        }
+    }
+    PRINT("ShortStringKeys");
+
+    {
+        //内存模式：不使用文件，语义与文件上的B+树相同，快照可以按任意存储方式打开
+        const int n = size * 64;
+        BPT::options_t options;
+        options.page_size = 4096;
+        options.wal = BPT::WAL_SYNC;
+        unlink("snap.db");
+        {
+            int_bpt tree(options);
+            assert(tree.meta.order == int_bpt::order_of_page(4096));
+            for (int i = 0; i < n; i++)
+                assert(tree.insert((int64_t)i * 7919 % n, i) == 0);
+            assert(tree.insert(0, 1) != 0);
+            for (int i = 0; i < n; i += 3)
+                assert(tree.remove(i) == 0);
+            for (int i = 1; i < n; i += 3)
+                assert(tree.update(i, -i) == 0);
+            assert(access(".wal", F_OK) != 0);
+            assert(tree.snapshot("snap.db") == 0);
+            //快照之后的修改不影响快照文件
+            assert(tree.remove(1) == 0);
+        }
+        for (int mode = 0; mode < 3; mode++)
+        {
+            BPT::options_t reopen;
+            reopen.mode = (BPT::storage_mode_t)mode;
+            int_bpt tree("snap.db", false, reopen);
+            for (int i = 0; i < n; i++)
+            {
+                int64_t value;
+                int ret = tree.search(i, &value);
+                assert((ret == 0) == (i % 3 != 0));
+                assert(ret != 0 || i % 3 != 1 || value == -i);
+            }
+            int64_t values[size * 64];
+            int64_t left = 0;
+            assert(tree.search_range(&left, n, values, n) == n - (n + 2) / 3);
+            if (mode == BPT::STORAGE_MEMORY)
+            {
+                //从快照载入的内存B+树可以继续修改，不写回快照文件
+                for (int i = 0; i < n; i += 3)
+                    assert(tree.insert(i, i) == 0);
+                std::vector<std::pair<int64_t, int64_t> > records;
+                for (int i = 0; i < n; i++)
+                    records.push_back(std::make_pair((int64_t)i, (int64_t)i));
+                assert(tree.bulk_load(records.begin(), records.end()) == 0);
+                assert(tree.search_range(&(left = 0), n, values, n) == n);
+            }
+        }
+        int_bpt tree("snap.db");
+        int64_t value;
+        assert(tree.search(0, &value) != 0 && tree.search(1, &value) == 0 && value == -1);
+        unlink("snap.db");
+    }
+    {
+        //默认的B+树叶子结点和内部结点的容量不同，内存模式下只读检查同样不复制结点
+        BPT::options_t options;
+        bpt tree(options);
+        assert(tree.meta.order < bpt::leaf_node_t::capacity);
+        for (int i = 0; i < size * 64; i++)
+        {
+            char key[16];
+            sprintf(key, "%d", i);
+            assert(tree.insert(key, i) == 0);
+        }
+        tree.reset_copy_stats();
+        assert(tree.insert("1", 0) == 1 && tree.remove("-1") == -1 && tree.update("-1", 0) != 0);
+        assert(tree.copy_stats().bytes_read == 0);
+    }
+    PRINT("MemoryMode");
+
+    {
+        //修改操作的结点帧在各次操作之间复用，只复制被修改的部分
+        typedef BPT::basic_bpt<int64_t, int64_t, BPT::key_compare<int64_t>, 4096> page_bpt;
+        BPT::options_t options;
+        options.mode = BPT::STORAGE_MMAP;
+        options.page_size = 4096;
+        page_bpt tree("test.db", true, options);
+        const int n = size * 64;
+        for (int i = 0; i < n; i++)
+            assert(tree.insert(i * 2, i) == 0);
+        assert(tree.frames.in_use() == 0);
+        size_t frames = tree.frames.capacity();
+        assert(frames > 0);
+        for (int i = 0; i < n; i += 2)
+            assert(tree.remove(i * 2) == 0);
+        for (int i = 0; i < n; i += 2)
+            assert(tree.insert(i * 2, i) == 0);
+        assert(tree.frames.in_use() == 0 && tree.frames.capacity() == frames);
+
+        BPT::copy_stats_t stats = tree.copy_stats();
+        assert(stats.operations == (uint64_t)(n + n / 2 * 2));
+        assert(stats.bytes_read > 0 && stats.bytes_written > 0);
+
+        //映射模式下结点的布局与结构体相同，只读检查不复制结点
+        tree.reset_copy_stats();
+        assert(tree.insert(2, 0) == 1);
+        assert(tree.remove(3) == -1);
+        assert(tree.update(5, 0) != 0);
+        stats = tree.copy_stats();
+        assert(stats.operations == 3 && stats.bytes_read == 0 && stats.bytes_written == 0);
+
+        //更新只写回一个value，不分裂的插入只写回结点头部和新数据项之后的部分
+        tree.reset_copy_stats();
+        assert(tree.update(4, -2) == 0);
+        stats = tree.copy_stats();
+        assert(stats.bytes_read == 0 && stats.bytes_written == sizeof(int64_t));
+        int64_t value;
+        assert(tree.search(4, &value) == 0 && value == -2);
+        tree.reset_copy_stats();
+        for (int i = 0; i < n; i++)
+            if (tree.insert(i * 2 + 1, i) == 0)
+                break;
+        stats = tree.copy_stats();
+        assert(stats.bytes_written < tree.size_of((page_bpt::leaf_node_t *)NULL));
+        for (int i = 0; i < n; i++)
+            assert(tree.search(i * 2, &value) == 0 && value == (i == 2 ? -2 : i));
+    }
+    {
+        //批量插入把一个叶子结点分裂成很多个时，新结点依次在同一个帧中构造
+        BPT::options_t options;
+        options.order = 4;
+        int_bpt tree(options);
+        std::vector<std::pair<int64_t, int64_t>> batch;
+        for (int i = 0; i < size * 64; i++)
+            batch.push_back(std::make_pair(i, i));
+        assert(tree.insert_batch(batch.begin(), batch.end()) == size * 64);
+        assert(tree.frames.in_use() == 0 && tree.frames.capacity() <= BP_ARENA_SLAB);
+        int64_t value;
+        for (int i = 0; i < size * 64; i++)
+            assert(tree.search(i, &value) == 0 && value == i);
+    }
+    PRINT("NodeArena");
+
+    {
+        //并行范围扫描：各段互不相交，按段号拼起来即为整个范围的有序结果
+        BPT::options_t options;
+        options.page_size = 256;
+        options.buffer_size = 1000;
+        int_bpt tree("test.db", true, options);
+        std::map<int64_t, int64_t> expect;
+        const int n = size * 64;
+        for (int i = 0; i < n; i++)
+        {
+            int64_t key = rand() % (n * 4) * 2;
+            if (tree.insert(key, i) == 0)
+                expect[key] = i;
+        }
+        int64_t ranges[][2] = {{-1, n * 8}, {100, 5000}, {7, 7}, {8, 8}, {n * 2 + 1, n * 6 - 1}, {n * 9, n * 10}};
+        size_t threads[] = {1, 4, 16};
+        for (int r = 0; r < 6; r++)
+            for (int t = 0; t < 3; t++)
+            {
+                int64_t left = ranges[r][0], right = ranges[r][1];
+                std::vector<std::vector<std::pair<int64_t, int64_t> > > sinks(threads[t]);
+                size_t count = tree.search_range_parallel(left, right, [&](size_t part, const int64_t &key, const int64_t &value)
+                                                          { sinks[part].push_back(std::make_pair(key, value)); },
+                                                          threads[t]);
+                std::vector<std::pair<int64_t, int64_t> > all;
+                for (size_t p = 0; p < sinks.size(); p++)
+                    all.insert(all.end(), sinks[p].begin(), sinks[p].end());
+                std::vector<std::pair<int64_t, int64_t> > want(expect.lower_bound(left), expect.upper_bound(right));
+                assert(count == want.size() && all == want);
+                //范围较大时确实分给了多个线程
+                if (r == 0 && threads[t] > 1)
+                    assert(sinks[1].size() > 0);
+            }
+        assert(tree.search_range_parallel(5, 4, [](size_t, const int64_t &, const int64_t &) {}) == 0);
+    }
+    PRINT("ParallelRangeScan");
+
+    {
+        //内部结点保存汇总值时与不保存时的区间汇总、rank、select结果都与std::map一致
+        const int n = size * 64;
+        for (int aggregated = 0; aggregated < 2; aggregated++)
+        {
+            BPT::options_t options;
+            options.page_size = 256;
+            options.aggregate = aggregated != 0;
+            std::map<int64_t, int64_t> expect;
+            {
+                int_bpt tree("test.db", true, options);
+                assert(tree.aggregated() == (aggregated != 0));
+                for (int i = 0; i < n; i++)
+                {
+                    int64_t key = rand() % (n * 2);
+                    if (tree.insert(key, i - n / 2) == 0)
+                        expect[key] = i - n / 2;
+                }
+                for (int i = 0; i < n / 2; i++)
+                {
+                    int64_t key = rand() % (n * 2);
+                    assert((tree.remove(key) == 0) == (expect.erase(key) == 1));
+                    key = rand() % (n * 2);
+                    if (tree.update(key, i) == 0)
+                        expect[key] = i;
+                }
+            }
+            //重新打开时由文件决定是否保存汇总值
+            options.aggregate = !options.aggregate;
+            int_bpt tree("test.db", false, options);
+            assert(tree.aggregated() == (aggregated != 0));
+            for (int i = 0; i < 200; i++)
+            {
+                int64_t left = rand() % (n * 2 + 20) - 10, right = rand() % (n * 2 + 20) - 10;
+                int_bpt::aggregate_t want = int_bpt::aggregate_t();
+                if (left <= right)
+                    for (std::map<int64_t, int64_t>::iterator it = expect.lower_bound(left);
+                         it != expect.end() && it->first <= right; ++it)
+                        want.add(it->second);
+                int_bpt::aggregate_t got = tree.aggregate(left, right);
+                assert(got == want);
+                assert(got.count == 0 || (got.min <= got.max && got.sum >= got.min * (int64_t)got.count));
+                assert(tree.rank(left) == (size_t)std::distance(expect.begin(), expect.lower_bound(left)));
+
+                size_t k = rand() % (expect.size() + 2);
+                int64_t key, value;
+                int ret = tree.select(k, &key, &value);
+                if (k < expect.size())
+                {
+                    std::map<int64_t, int64_t>::iterator it = expect.begin();
+                    std::advance(it, k);
+                    assert(ret == 0 && key == it->first && value == it->second);
+                }
+                else
+                    assert(ret != 0);
+            }
+            assert(tree.aggregate(-1, n * 2).count == expect.size());
+        }
+
+        //内部结点保存汇总值时，其中的查找同样经过key_search，每层一次
+        typedef BPT::basic_bpt<int64_t, int64_t, counted_compare> counted_bpt;
+        typedef BPT::key_search<int64_t, counted_compare> counted_search;
+        BPT::options_t options;
+        options.page_size = 256;
+        options.aggregate = true;
+        counted_bpt tree("test.db", true, options);
+        for (int i = 0; i < n; i++)
+            assert(tree.insert(i, i) == 0);
+        assert(tree.meta.height > 1);
+        counted_search::calls = 0;
+        assert(tree.rank(n / 2) == (size_t)n / 2);
+        assert(counted_search::calls == tree.meta.height + 1);
+        counted_search::calls = 0;
+        int64_t key, value;
+        assert(tree.select(n / 3, &key, &value) == 0 && key == n / 3);
+        assert(tree.search(n / 3, &value) == 0 && value == n / 3);
+        counted_bpt::internal_node_t root;
+        assert(tree.read(&root, tree.meta.root_offset) == 0);
+        counted_bpt::find(root, n / 3);
+        assert(counted_search::calls == tree.meta.height + 2);
+    }
+    {
+        //过大的阶数要按带汇总值的内部结点截断，结点不能超过PageSize
+        BPT::options_t options;
+        options.order = 100000;
+        options.aggregate = true;
+        int_bpt tree("test.db", true, options);
+        assert(tree.meta.order == int_bpt::order_of_page(BP_MAX_NODE_SIZE, true));
+        assert(tree.meta.order < int_bpt::max_order);
+        int_bpt::internal_node_t node;
+        assert(tree.size_of(&node) <= BP_MAX_NODE_SIZE);
+        for (int i = 0; i < 20000; i++)
+            assert(tree.insert(i, i) == 0);
+        int64_t value;
+        for (int i = 0; i < 20000; i += 7)
+            assert(tree.search(i, &value) == 0 && value == i);
+        assert(tree.rank(15000) == 15000);
+    }
+    {
+        //打开阶数超出限制的汇总树时视为出错，重新建立
+        BPT::options_t options;
+        options.aggregate = true;
+        {
+            int_bpt tree("test.db", true, options);
+            assert(tree.insert(1, 1) == 0);
+            //模拟旧版本按不带汇总值的结点计算阶数写入的文件
+            tree.meta.order = int_bpt::max_order;
+            tree.write(&tree.meta, OFFSET_META);
+        }
+        int_bpt tree("test.db", false, options);
+        assert(tree.meta.order != int_bpt::max_order &&
+               tree.meta.order <= int_bpt::order_of_page(BP_MAX_NODE_SIZE, true));
+        int64_t value;
+        assert(tree.search(1, &value) != 0);
+    }
+    PRINT("RangeAggregates");
     unlink("test.db");
 
     return 0;
@@ -0,0 +1,239 @@
+#include "../include/wal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+
+namespace BPT
+{
+    //日志记录头，其后是count个页面，每个页面为偏移量加BP_PAGE_SIZE字节的内容
+    struct wal_record_t
+    {
+        uint32_t magic;
+        uint32_t checksum; //count及之后所有内容的校验和
+        uint64_t count;
+    };
+#define WAL_MAGIC 0x4c415742
+#define WAL_ENTRY_SIZE (sizeof(off_t) + BP_PAGE_SIZE)
+
+    //CRC32查找表，静态初始化，多个线程同时计算校验和也是安全的
+    struct crc_table_t
+    {
+        uint32_t entries[256];
+        crc_table_t()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                entries[i] = c;
+            }
+        }
+    };
+    static const crc_table_t crc_table;
+
+    uint32_t checksum(const void *data, size_t size, uint32_t crc)
+    {
+        const unsigned char *p = (const unsigned char *)data;
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++)
+            crc = crc_table.entries[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    wal_t::wal_t()
+        : mode(WAL_OFF), start(0), appended(0), durable(0), requested(0), stop(false), failed(false)
+    {
+    }
+
+    wal_t::~wal_t()
+    {
+        close();
+    }
+
+    int wal_t::open(const char *path, wal_mode_t mode)
+    {
+        close();
+        if (file.open(path) != 0)
+            return -1;
+        off_t size = file.size();
+        if (size < 0)
+            return -1;
+        this->mode = mode;
+        start = 0;
+        appended = durable = requested = size;
+        stop = failed = false;
+        if (mode == WAL_ASYNC || mode == WAL_GROUP)
+            thread = std::thread(&wal_t::run, this);
+        return 0;
+    }
+
+    void wal_t::close()
+    {
+        if (thread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            wake.notify_all();
+            thread.join();
+        }
+        sync();
+        file.close();
+        mode = WAL_OFF;
+    }
+
+    int wal_t::replay(const page_io *io)
+    {
+        //按页对齐，数据文件可能使用O_DIRECT
+        void *page = NULL;
+        if (posix_memalign(&page, BP_PAGE_SIZE, BP_PAGE_SIZE) != 0)
+            return -1;
+        std::vector<char> body;
+        off_t end = file.size();
+        off_t pos = 0;
+        int records = 0;
+        while (pos + (off_t)sizeof(wal_record_t) <= end)
+        {
+            wal_record_t record;
+            if (file.read_page(&record, pos, sizeof(record)) != (ssize_t)sizeof(record) ||
+                record.magic != WAL_MAGIC)
+                break;
+            //记录不完整或者校验和不对，说明写入记录时发生了崩溃
+            size_t length = record.count * WAL_ENTRY_SIZE;
+            if (record.count > (uint64_t)(end - pos) / WAL_ENTRY_SIZE)
+                break;
+            body.resize(length);
+            if (file.read_page(body.data(), pos + sizeof(record), length) != (ssize_t)length)
+                break;
+            uint32_t crc = checksum(&record.count, sizeof(record.count));
+            if (checksum(body.data(), length, crc) != record.checksum)
+                break;
+
+            for (size_t i = 0; i < record.count; i++)
+            {
+                const char *entry = body.data() + i * WAL_ENTRY_SIZE;
+                off_t offset;
+                memcpy(&offset, entry, sizeof(off_t));
+                memcpy(page, entry + sizeof(off_t), BP_PAGE_SIZE);
+                if (io->write_page(page, offset, BP_PAGE_SIZE) != BP_PAGE_SIZE)
+                {
+                    free(page);
+                    return -1;
+                }
+            }
+            pos += sizeof(record) + length;
+            ++records;
+        }
+        free(page);
+        return records;
+    }
+
+    uint64_t wal_t::append(const off_t *offsets, const char *const *pages, size_t count)
+    {
+        //整条记录一次写入
+        std::vector<char> buf(sizeof(wal_record_t) + count * WAL_ENTRY_SIZE);
+        wal_record_t *record = (wal_record_t *)buf.data();
+        record->magic = WAL_MAGIC;
+        record->count = count;
+        char *entry = buf.data() + sizeof(wal_record_t);
+        for (size_t i = 0; i < count; i++, entry += WAL_ENTRY_SIZE)
+        {
+            memcpy(entry, &offsets[i], sizeof(off_t));
+            memcpy(entry + sizeof(off_t), pages[i], BP_PAGE_SIZE);
+        }
+        uint32_t crc = checksum(&record->count, sizeof(record->count));
+        record->checksum = checksum(buf.data() + sizeof(wal_record_t),
+                                    buf.size() - sizeof(wal_record_t), crc);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (file.write_page(buf.data(), appended - start, buf.size()) != (ssize_t)buf.size())
+        {
+            failed = true;
+            return 0;
+        }
+        appended += buf.size();
+        return appended;
+    }
+
+    int wal_t::commit(uint64_t lsn)
+    {
+        if (lsn == 0)
+            return -1;
+        if (mode == WAL_SYNC)
+            return sync();
+        if (mode != WAL_GROUP)
+            return 0;
+
+        //交给后台线程刷盘，等待期间提交的记录在同一次fdatasync中落盘
+        std::unique_lock<std::mutex> lock(mutex);
+        if (lsn > requested)
+            requested = lsn;
+        wake.notify_one();
+        done.wait(lock, [&] { return durable >= lsn || failed || stop; });
+        return durable >= lsn ? 0 : -1;
+    }
+
+    int wal_t::sync()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (durable >= appended)
+            return failed ? -1 : 0;
+        uint64_t target = appended;
+        lock.unlock();
+        int ret = file.sync();
+        lock.lock();
+        if (ret != 0)
+            failed = true;
+        else if (target > durable)
+            durable = target;
+        done.notify_all();
+        return ret;
+    }
+
+    int wal_t::reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        start = durable = requested = appended;
+        //截断本身也要落盘，否则崩溃后旧的记录会被再次重做
+        if (file.truncate() != 0 || file.sync() != 0)
+        {
+            failed = true;
+            return -1;
+        }
+        return 0;
+    }
+
+    uint64_t wal_t::size()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return appended - start;
+    }
+
+    void wal_t::run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stop)
+        {
+            if (mode == WAL_GROUP)
+                wake.wait(lock, [&] { return stop || requested > durable; });
+            else
+                wake.wait_for(lock, std::chrono::milliseconds(BP_WAL_ASYNC_INTERVAL));
+            if (durable >= appended)
+                continue;
+
+            uint64_t target = appended;
+            lock.unlock();
+            int ret = file.sync();
+            lock.lock();
+            if (ret != 0)
+                failed = true;
+            else if (target > durable)
+                durable = target;
+            done.notify_all();
+        }
+    }
+}